@@ -0,0 +1,19 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+/* Generated by chip8-transpile (see transpile.c) */
+extern const uint8_t AOT_ROM[];
+extern const size_t AOT_ROM_SIZE;
+extern const uint8_t AOT_CODE_MAP[MEMORY_SIZE]; // 1 for every translated byte
+extern size_t aot_run(chip8_t *c8, const size_t budget);
+
+/* Provided by chip8.c */
+extern uint8_t g_aot_valid;
+extern void aot_execute(chip8_t *c8);
+
+#endif // AOT_H
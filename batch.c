@@ -0,0 +1,830 @@
+/*
+ * The functions in this file implement batch mode, in which many instances of
+ * the same CHIP-8 program run headless in a single thread. The instances are
+ * kept in "structure of arrays" form: each register holds one value per
+ * instance, side by side in memory. The instances execute in lockstep, one
+ * instruction at a time. When every instance that runs is about to execute the
+ * same instruction, simple instructions run as one loop across all instances,
+ * which the compiler turns into SIMD (SSE/AVX2) code. Instances that halted or
+ * wait for the next frame are masked out of that loop, and keep their
+ * registers. Otherwise, each instance executes the instruction on its own.
+ *
+ * Each instance has its own memory, but instructions are fetched from one
+ * shared copy of the program as it was loaded, so that finding whether the
+ * instances are in lockstep only compares their program counters. An instance
+ * fetches from its own memory only where it has written (`Fx33`, `Fx55`), e.g.
+ * when its code modifies itself.
+ *
+ * The instructions behave as in chip8.c, including the errors that stop an
+ * instance, and `Fx0A` takes the keys in the order in which they are released.
+ *
+ * Instance i draws the same random numbers as a headless run with seed
+ * `--seed` + i, and presses the keys that a batch input script
+ * (`--batch-input FILE`) gives it; without one, no key is ever pressed. Only
+ * the 64x32 display is supported, so an instance that uses SUPER-CHIP display
+ * instructions halts. Batch mode ends once every instance has halted.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "chip8.h"
+#include "headless.h"
+#include "io.h"
+#include "keypad.h"
+#include "load.h"
+#include "script.h"
+
+size_t g_batch_size = 0;    // number of instances, 0 if batch mode is off
+
+typedef struct
+{
+    size_t size;            // number of instances
+
+    /* Per instance arrays */
+    uint8_t *memory;        // MEMORY_SIZE bytes per instance
+    uint8_t *V[16];
+    uint16_t *I;
+    uint16_t *program_counter;
+    uint16_t *stack;        // STACK_SIZE entries per instance
+    int8_t *stack_pointer;
+    uint8_t *delay_timer;
+    uint8_t *sound_timer;
+    uint64_t *display;      // one 64-pixel row per word, DISPLAY_HEIGHT rows
+    uint32_t *random_state;
+    uint32_t *written_start;    // range of memory that an instance wrote to,
+    uint32_t *written_end;      // empty if both are 0
+    uint16_t *keypad;       // bit k is set while key k is pressed
+    uint8_t *key_events;    // key changes at the start of this frame
+    uint8_t *releases;      // KEY_QUEUE_SIZE keys released in this frame
+    uint8_t *num_releases;
+    uint8_t *next_release;  // the next release for `Fx0A` to take
+    uint8_t *halted;        // set once an instance hits an error
+    uint8_t *end_of_frame;  // set when an instance must wait for the next frame
+    uint8_t *running;       // set if an instance executes in the current step
+
+    /* The program as loaded, fetched from where an instance did not write */
+    uint8_t code[MEMORY_SIZE];
+    uint32_t any_written_start; // range of memory that any instance wrote to
+    uint32_t any_written_end;
+
+    /* Current frame */
+    size_t step;            // instructions into the frame
+    size_t skipped;         // instructions skipped in delay timer loops
+    size_t num_running;     // instances that execute, if `running` is known
+    size_t first_running;
+    uint8_t running_known;  // 0 if `running` must be found again
+    uint8_t lockstep;       // 1 if every instance that runs is at one address
+
+} batch_t;
+
+static void *allocate(batch_t *b, const size_t count, const size_t size)
+{
+    void *p = calloc(b->size * count, size);
+    if (!p)
+    {
+        printf("[ERROR] Unable to allocate %zu instances\n", b->size);
+        pthread_exit(NULL);
+    }
+    return p;
+}
+
+static void batch_init(batch_t *b, const size_t size)
+{
+    memset(b, 0, sizeof(*b));
+    b->size = size;
+    b->memory = allocate(b, MEMORY_SIZE, sizeof(*b->memory));
+    for (size_t x = 0; x < 16; x++)
+    {
+        b->V[x] = allocate(b, 1, sizeof(*b->V[x]));
+    }
+    b->I = allocate(b, 1, sizeof(*b->I));
+    b->program_counter = allocate(b, 1, sizeof(*b->program_counter));
+    b->stack = allocate(b, STACK_SIZE, sizeof(*b->stack));
+    b->stack_pointer = allocate(b, 1, sizeof(*b->stack_pointer));
+    b->delay_timer = allocate(b, 1, sizeof(*b->delay_timer));
+    b->sound_timer = allocate(b, 1, sizeof(*b->sound_timer));
+    b->display = allocate(b, DISPLAY_HEIGHT, sizeof(*b->display));
+    b->random_state = allocate(b, 1, sizeof(*b->random_state));
+    b->written_start = allocate(b, 1, sizeof(*b->written_start));
+    b->written_end = allocate(b, 1, sizeof(*b->written_end));
+    b->keypad = allocate(b, 1, sizeof(*b->keypad));
+    b->key_events = allocate(b, 1, sizeof(*b->key_events));
+    b->releases = allocate(b, KEY_QUEUE_SIZE, sizeof(*b->releases));
+    b->num_releases = allocate(b, 1, sizeof(*b->num_releases));
+    b->next_release = allocate(b, 1, sizeof(*b->next_release));
+    b->halted = allocate(b, 1, sizeof(*b->halted));
+    b->end_of_frame = allocate(b, 1, sizeof(*b->end_of_frame));
+    b->running = allocate(b, 1, sizeof(*b->running));
+
+    // Every instance starts with the same memory
+    load_memory(b->code);
+    for (size_t i = 0; i < size; i++)
+    {
+        memcpy(&b->memory[i*MEMORY_SIZE], b->code, MEMORY_SIZE);
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+        b->program_counter[i] = PROGRAM_START;
+        b->stack_pointer[i] = -1;
+        b->random_state[i] = seed_random(g_seed + i);
+    }
+}
+
+static void batch_quit(batch_t *b)
+{
+    free(b->memory);
+    for (size_t x = 0; x < 16; x++)
+    {
+        free(b->V[x]);
+    }
+    free(b->I);
+    free(b->program_counter);
+    free(b->stack);
+    free(b->stack_pointer);
+    free(b->delay_timer);
+    free(b->sound_timer);
+    free(b->display);
+    free(b->random_state);
+    free(b->written_start);
+    free(b->written_end);
+    free(b->keypad);
+    free(b->key_events);
+    free(b->releases);
+    free(b->num_releases);
+    free(b->next_release);
+    free(b->halted);
+    free(b->end_of_frame);
+    free(b->running);
+}
+
+/*
+ * Returns nonzero if instance i did not write to any of the `size` bytes at the
+ * address, which are then the same as in the program as loaded.
+ */
+static inline int unwritten(
+    const batch_t *b, const size_t i, const size_t address, const size_t size
+)
+{
+    return ((address + size) <= b->written_start[i]) |
+        (address >= b->written_end[i]);
+}
+
+/*
+ * Return the memory that instance i reads the `size` bytes of code at the
+ * address from.
+ */
+static inline const uint8_t *code(
+    const batch_t *b, const size_t i, const size_t address, const size_t size
+)
+{
+    return unwritten(b, i, address, size) ?
+        b->code : &b->memory[i*MEMORY_SIZE];
+}
+
+/*
+ * Grow a range of written memory, which is empty if both ends are 0, to cover
+ * the `size` bytes at the address.
+ */
+static void add_to_range(
+    uint32_t *start, uint32_t *end, const size_t address, const size_t size
+)
+{
+    if ((*start == *end) || (address < *start)) *start = address;
+    if ((address + size) > *end) *end = (address + size);
+}
+
+static void note_write(
+    batch_t *b, const size_t i, const size_t address, const size_t size
+)
+{
+    add_to_range(&b->written_start[i], &b->written_end[i], address, size);
+    add_to_range(
+        &b->any_written_start, &b->any_written_end, address, size
+    );
+}
+
+static inline uint16_t fetch(const batch_t *b, const size_t i)
+{
+    const uint16_t pc = b->program_counter[i];
+    const uint8_t *memory = code(b, i, pc, 2);
+    return ((memory[pc] << 8) | memory[pc+1]);
+}
+
+static void halt(batch_t *b, const size_t i, const uint16_t instruction)
+{
+    printf(
+        "[ERROR] Instance %zu halted (Memory[0x%03x]: 0x%04x)\n",
+        i, b->program_counter[i]-2, instruction
+    );
+    b->halted[i] = 1;
+}
+
+static uint8_t draw_sprite(
+    batch_t *b, const size_t i, size_t row, size_t col,
+    const uint8_t *sprite_address, const size_t sprite_height
+)
+{
+    // Implements full sprite wrap, like draw.c
+    row &= (DISPLAY_HEIGHT-1);
+    col &= (DISPLAY_WIDTH-1);
+
+    uint64_t *display = &b->display[i*DISPLAY_HEIGHT];
+    uint64_t collision = 0;
+    for (size_t j = 0; (j < sprite_height) && ((row+j) < DISPLAY_HEIGHT); j++)
+    {
+        const uint64_t line = ((uint64_t)sprite_address[j] << 56) >> col;
+        collision |= (display[row+j] & line);
+        display[row+j] ^= line;
+    }
+    return (collision != 0);
+}
+
+/*
+ * If the `Fx07` that an instance just executed starts a delay timer loop that
+ * will go around again, skip to where the instance would be in the loop at the
+ * end of the frame. This mirrors `is_idle_loop()` in chip8.c.
+ */
+static void skip_idle_loop(batch_t *b, const size_t i, const uint8_t x)
+{
+    uint16_t *pc = &b->program_counter[i];
+    const uint16_t start = (*pc-2);
+    if ((start + 6) > MEMORY_SIZE) return;
+    const uint8_t *memory = code(b, i, *pc, 4);
+    const uint16_t skip = ((memory[*pc] << 8) | memory[*pc+1]);
+    const uint16_t jump = ((memory[*pc+2] << 8) | memory[*pc+3]);
+    if ((jump != (0x1000 | start)) || (((skip & 0x0f00) >> 8) != x)) return;
+    const uint8_t vx = b->V[x][i];
+    const uint8_t nn = (skip & 0x00ff);
+    if (!(((skip >> 12) == 0x3) && (vx != nn)) &&
+        !(((skip >> 12) == 0x4) && (vx == nn)))
+    {
+        return;
+    }
+
+    const size_t remaining = (g_ipf - (b->step+1));
+    *pc = (start + 2*((1 + remaining) % 3));
+    b->end_of_frame[i] = 1;
+    b->skipped += remaining;
+}
+
+/*
+ * Execute one instruction for a single instance. This mirrors the instruction
+ * set in chip8.c.
+ */
+static void execute_one(batch_t *b, const size_t i, const uint16_t instruction)
+{
+    const uint16_t nnn = (instruction & 0x0fff);
+    const uint8_t nn = (instruction & 0x00ff);
+    const uint8_t n = (instruction & 0x000f);
+    const uint8_t x = ((instruction & 0x0f00) >> 8);
+    const uint8_t y = ((instruction & 0x00f0) >> 4);
+    uint8_t *memory = &b->memory[i*MEMORY_SIZE];
+    uint16_t *stack = &b->stack[i*STACK_SIZE];
+    uint8_t **V = b->V;
+    uint16_t *pc = &b->program_counter[i];
+    uint8_t before, flag, pressed;
+    size_t address;
+
+    *pc += 2;
+    switch (instruction >> 12)
+    {
+        case 0x0:
+            if (instruction == 0x00e0)
+            {
+                memset(
+                    &b->display[i*DISPLAY_HEIGHT], 0,
+                    DISPLAY_HEIGHT*sizeof(*b->display)
+                );
+                b->end_of_frame[i] = g_display_wait;
+            }
+            else if (instruction == 0x00ee)
+            {
+                if (b->stack_pointer[i] == -1) goto error;
+                *pc = stack[b->stack_pointer[i]--];
+            }
+            else
+            {
+#ifdef LEGACY
+                *pc = nnn;
+#else
+                goto error;
+#endif
+            }
+            break;
+        case 0x1:
+            if (nnn < PROGRAM_START) goto error;
+            *pc = nnn;
+            break;
+        case 0x2:
+            if (b->stack_pointer[i] == (STACK_SIZE-1)) goto error;
+            if (nnn < PROGRAM_START) goto error;
+            stack[++b->stack_pointer[i]] = *pc;
+            *pc = nnn;
+            break;
+        case 0x3:
+            if (V[x][i] == nn) *pc += instruction_length(memory, *pc);
+            break;
+        case 0x4:
+            if (V[x][i] != nn) *pc += instruction_length(memory, *pc);
+            break;
+        case 0x5:
+            if (n != 0x0) goto error;
+            if (V[x][i] == V[y][i]) *pc += instruction_length(memory, *pc);
+            break;
+        case 0x6:
+            V[x][i] = nn;
+            break;
+        case 0x7:
+            V[x][i] += nn;
+            break;
+        case 0x8:
+            switch (n)
+            {
+                case 0x0: V[x][i] = V[y][i]; break;
+                case 0x1: V[x][i] |= V[y][i]; V[0xf][i] = 0; break;
+                case 0x2: V[x][i] &= V[y][i]; V[0xf][i] = 0; break;
+                case 0x3: V[x][i] ^= V[y][i]; V[0xf][i] = 0; break;
+                case 0x4:
+                    before = V[x][i];
+                    V[x][i] += V[y][i];
+                    V[0xf][i] = (V[x][i] < before) ? 1 : 0;
+                    break;
+                case 0x5:
+                    before = V[x][i];
+                    V[x][i] -= V[y][i];
+                    V[0xf][i] = (V[x][i] > before) ? 0 : 1;
+                    break;
+                case 0x6:
+#ifdef COSMAC_VIP
+                    flag = (V[y][i] & 0x01);
+                    V[y][i] >>= 1;
+                    V[x][i] = V[y][i];
+#else
+                    flag = (V[x][i] & 0x01);
+                    V[x][i] >>= 1;
+#endif
+                    V[0xf][i] = flag;
+                    break;
+                case 0x7:
+                    V[x][i] = (V[y][i] - V[x][i]);
+                    V[0xf][i] = (V[x][i] > V[y][i]) ? 0 : 1;
+                    break;
+                case 0xe:
+#ifdef COSMAC_VIP
+                    flag = ((V[y][i] & 0x80) >> 7);
+                    V[y][i] <<= 1;
+                    V[x][i] = V[y][i];
+#else
+                    flag = ((V[x][i] & 0x80) >> 7);
+                    V[x][i] <<= 1;
+#endif
+                    V[0xf][i] = flag;
+                    break;
+                default:
+                    goto error;
+            }
+            break;
+        case 0x9:
+            if (n != 0x0) goto error;
+            if (V[x][i] != V[y][i]) *pc += instruction_length(memory, *pc);
+            break;
+        case 0xa:
+            b->I[i] = nnn;
+            break;
+        case 0xb:
+#ifdef COSMAC_VIP
+            address = V[0x0][i] + nnn;
+#else
+            address = V[x][i] + nnn;
+#endif
+            if ((address < PROGRAM_START) || (address >= MEMORY_SIZE))
+            {
+                goto error;
+            }
+            *pc = address;
+            break;
+        case 0xc:
+            V[x][i] = (next_random(&b->random_state[i]) & nn);
+            break;
+        case 0xd:
+#ifdef SUPER_CHIP
+            // Batch mode only has the 64x32 display
+            if (n == 0x0) goto error;
+#endif
+            if ((b->I[i] + n) > MEMORY_SIZE) goto error;
+            V[0xf][i] = draw_sprite(
+                b, i, V[y][i], V[x][i], &memory[b->I[i]], n
+            );
+            b->end_of_frame[i] = g_display_wait;
+            break;
+        case 0xe:
+            // `Ex9E` skips if the key in Vx is pressed, `ExA1` if it is not
+            if ((nn != 0x9e) && (nn != 0xa1)) goto error;
+            pressed = ((b->keypad[i] >> (V[x][i] & 0xf)) & 1);
+            if (pressed == (nn == 0x9e)) *pc += instruction_length(memory, *pc);
+            break;
+        case 0xf:
+            switch (nn)
+            {
+                case 0x07:
+                    V[x][i] = b->delay_timer[i];
+                    skip_idle_loop(b, i, x);
+                    break;
+                case 0x0a:
+                    if (b->next_release[i] == b->num_releases[i])
+                    {
+                        // Wait for a key release in a later frame
+                        *pc -= 2;
+                        b->end_of_frame[i] = 1;
+                        break;
+                    }
+                    V[x][i] = b->releases[
+                        i*KEY_QUEUE_SIZE + b->next_release[i]++
+                    ];
+                    break;
+                case 0x15: b->delay_timer[i] = V[x][i]; break;
+                case 0x18:
+                    if (V[x][i] >= 0x02) b->sound_timer[i] = V[x][i];
+                    break;
+                case 0x1e: b->I[i] += V[x][i]; break;
+                case 0x29:
+                    b->I[i] = FONT_START + FONT_SIZE*(V[x][i] & 0x0f);
+                    break;
+                case 0x33:
+                    if ((b->I[i] + 3) > MEMORY_SIZE) goto error;
+                    note_write(b, i, b->I[i], 3);
+                    memory[b->I[i]] = (V[x][i] / 100);
+                    memory[b->I[i]+1] = ((V[x][i] / 10) % 10);
+                    memory[b->I[i]+2] = (V[x][i] % 10);
+                    break;
+                case 0x55:
+                    if ((b->I[i] + x + 1) > MEMORY_SIZE) goto error;
+                    note_write(b, i, b->I[i], x + 1);
+                    for (size_t r = 0; r <= x; r++)
+                    {
+                        memory[b->I[i]+r] = V[r][i];
+                    }
+                    b->I[i] += (x + 1);
+                    break;
+                case 0x65:
+                    if ((b->I[i] + x + 1) > MEMORY_SIZE) goto error;
+                    for (size_t r = 0; r <= x; r++)
+                    {
+                        V[r][i] = memory[b->I[i]+r];
+                    }
+                    b->I[i] += (x + 1);
+                    break;
+                default:
+                    goto error;
+            }
+            break;
+    }
+    return;
+
+error:
+    halt(b, i, instruction);
+}
+
+/* A register's new value in instance i if it runs, or else its old value */
+#define BLEND(i, value, old) (((value) & -run[i]) | ((old) & ~-run[i]))
+
+/*
+ * Execute one instruction for all instances that run at once. Only
+ * instructions that touch nothing but registers are handled here. Every loop
+ * goes over all instances, and only takes the new values in those that run.
+ * Returns 0 if the instruction must be executed by each instance on its own
+ * instead.
+ */
+static int execute_all(batch_t *b, const uint16_t instruction)
+{
+    const size_t size = b->size;
+    const uint16_t nnn = (instruction & 0x0fff);
+    const uint8_t nn = (instruction & 0x00ff);
+    const uint8_t *run = b->running;
+    uint8_t *vx = b->V[(instruction & 0x0f00) >> 8];
+    uint8_t *vy = b->V[(instruction & 0x00f0) >> 4];
+    uint8_t *vf = b->V[0xf];
+    uint16_t *pc = b->program_counter;
+    const uint8_t equal = ((instruction >> 12) == 0x3);
+
+    switch (instruction >> 12)
+    {
+        case 0x1:
+            if (nnn < PROGRAM_START) return 0;
+            for (size_t i = 0; i < size; i++) pc[i] = BLEND(i, nnn, pc[i]);
+            return 1;
+        case 0x3:
+        case 0x4:
+            for (size_t i = 0; i < size; i++)
+            {
+                // `3xnn` skips if Vx == byte, `4xnn` if Vx != byte
+                const uint8_t skip = ((vx[i] == nn) == equal);
+                const uint16_t next = (pc[i] + 2);
+                const uint16_t length = skip ?
+                    instruction_length(code(b, i, next, 2), next) : 0;
+                pc[i] = BLEND(i, (next + length), pc[i]);
+            }
+            return 1;
+        case 0x6:
+            for (size_t i = 0; i < size; i++) vx[i] = BLEND(i, nn, vx[i]);
+            break;
+        case 0x7:
+            for (size_t i = 0; i < size; i++)
+            {
+                vx[i] = BLEND(i, (uint8_t)(vx[i] + nn), vx[i]);
+            }
+            break;
+        case 0x8:
+            switch (instruction & 0x000f)
+            {
+                case 0x0:
+                    for (size_t i = 0; i < size; i++)
+                    {
+                        vx[i] = BLEND(i, vy[i], vx[i]);
+                    }
+                    break;
+                case 0x1:
+                    for (size_t i = 0; i < size; i++)
+                    {
+                        vx[i] = BLEND(i, (vx[i] | vy[i]), vx[i]);
+                        vf[i] = BLEND(i, 0, vf[i]);
+                    }
+                    break;
+                case 0x2:
+                    for (size_t i = 0; i < size; i++)
+                    {
+                        vx[i] = BLEND(i, (vx[i] & vy[i]), vx[i]);
+                        vf[i] = BLEND(i, 0, vf[i]);
+                    }
+                    break;
+                case 0x3:
+                    for (size_t i = 0; i < size; i++)
+                    {
+                        vx[i] = BLEND(i, (vx[i] ^ vy[i]), vx[i]);
+                        vf[i] = BLEND(i, 0, vf[i]);
+                    }
+                    break;
+                case 0x4:
+                    for (size_t i = 0; i < size; i++)
+                    {
+                        const uint8_t before = vx[i];
+                        vx[i] = BLEND(i, (uint8_t)(before + vy[i]), before);
+                        vf[i] = BLEND(i, (vx[i] < before), vf[i]);
+                    }
+                    break;
+                case 0x5:
+                    for (size_t i = 0; i < size; i++)
+                    {
+                        const uint8_t before = vx[i];
+                        vx[i] = BLEND(i, (uint8_t)(before - vy[i]), before);
+                        vf[i] = BLEND(i, (vx[i] <= before), vf[i]);
+                    }
+                    break;
+                case 0x7:
+                    for (size_t i = 0; i < size; i++)
+                    {
+                        vx[i] = BLEND(i, (uint8_t)(vy[i] - vx[i]), vx[i]);
+                        vf[i] = BLEND(i, (vx[i] <= vy[i]), vf[i]);
+                    }
+                    break;
+                default:
+                    return 0;
+            }
+            break;
+        case 0xa:
+            for (size_t i = 0; i < size; i++)
+            {
+                b->I[i] = BLEND(i, nnn, b->I[i]);
+            }
+            break;
+        case 0xc:
+            for (size_t i = 0; i < size; i++)
+            {
+                uint32_t state = b->random_state[i];
+                const uint8_t value = (next_random(&state) & nn);
+                vx[i] = BLEND(i, value, vx[i]);
+                b->random_state[i] = BLEND(i, state, b->random_state[i]);
+            }
+            break;
+        case 0xf:
+            switch (nn)
+            {
+                case 0x15:
+                    for (size_t i = 0; i < size; i++)
+                    {
+                        b->delay_timer[i] = BLEND(i, vx[i], b->delay_timer[i]);
+                    }
+                    break;
+                case 0x18:
+                    for (size_t i = 0; i < size; i++)
+                    {
+                        // Shorter sounds are not played, as in chip8.c
+                        const uint8_t old = b->sound_timer[i];
+                        const uint8_t value = (vx[i] >= 0x02) ? vx[i] : old;
+                        b->sound_timer[i] = BLEND(i, value, old);
+                    }
+                    break;
+                case 0x1e:
+                    for (size_t i = 0; i < size; i++)
+                    {
+                        const uint16_t sum = (b->I[i] + vx[i]);
+                        b->I[i] = BLEND(i, sum, b->I[i]);
+                    }
+                    break;
+                case 0x29:
+                    for (size_t i = 0; i < size; i++)
+                    {
+                        const uint16_t font =
+                            FONT_START + FONT_SIZE*(vx[i] & 0x0f);
+                        b->I[i] = BLEND(i, font, b->I[i]);
+                    }
+                    break;
+                default:
+                    return 0;
+            }
+            break;
+        default:
+            return 0;
+    }
+    for (size_t i = 0; i < size; i++) pc[i] += 2*run[i];
+    return 1;
+}
+
+/*
+ * Find the instances that execute in this step, and whether they are all at the
+ * same address. Both only change when an instance executes an instruction on
+ * its own, or when `execute_all()` takes a skip.
+ */
+static void find_running(batch_t *b)
+{
+    if (!b->running_known)
+    {
+        b->num_running = 0;
+        for (size_t i = 0; i < b->size; i++)
+        {
+            b->running[i] = (!b->halted[i] && !b->end_of_frame[i]);
+            if (!b->running[i]) continue;
+            if (!b->num_running) b->first_running = i;
+            b->num_running++;
+        }
+        b->running_known = 1;
+        b->lockstep = 0;
+    }
+    if (!b->num_running || b->lockstep) return;
+
+    const uint16_t pc = b->program_counter[b->first_running];
+    uint8_t lockstep = 1;
+    for (size_t i = b->first_running+1; i < b->size; i++)
+    {
+        lockstep &= ((b->running[i] == 0) | (b->program_counter[i] == pc));
+    }
+    b->lockstep = lockstep;
+}
+
+/*
+ * Execute one instruction in every instance that is ready to. Returns the
+ * number of instances that executed an instruction.
+ */
+static size_t step(batch_t *b)
+{
+    find_running(b);
+    const size_t count = b->num_running;
+    const size_t first = b->first_running;
+    if (!count) return 0;
+
+    // Instances in lockstep fetch the same instruction, unless one of them
+    // wrote to it
+    const uint16_t pc = b->program_counter[first];
+    if (
+        b->lockstep && (pc < (MEMORY_SIZE-1)) &&
+        ((((size_t)pc + 2) <= b->any_written_start) ||
+            (pc >= b->any_written_end))
+    )
+    {
+        const uint16_t instruction = ((b->code[pc] << 8) | b->code[pc+1]);
+        if (execute_all(b, instruction))
+        {
+            // A skip may be taken by some instances and not by others
+            const uint8_t opcode = (instruction >> 12);
+            b->lockstep = ((opcode != 0x3) && (opcode != 0x4));
+            return count;
+        }
+        for (size_t i = first; i < b->size; i++)
+        {
+            if (b->running[i]) execute_one(b, i, instruction);
+        }
+        b->running_known = 0;
+        return count;
+    }
+
+    for (size_t i = first; i < b->size; i++)
+    {
+        if (!b->running[i]) continue;
+        if (b->program_counter[i] >= (MEMORY_SIZE-1))
+        {
+            // There is no whole instruction left to fetch
+            b->program_counter[i] += 2;
+            halt(b, i, 0x0000);
+            continue;
+        }
+        execute_one(b, i, fetch(b, i));
+    }
+    b->running_known = 0;
+    return count;
+}
+
+/*
+ * Apply the scripted key changes (`--batch-input`) that happen at the start of
+ * the frame after `frame`.
+ */
+static void apply_input(batch_t *b, const size_t frame)
+{
+    // A key release only ends an `Fx0A` wait during the frame it happens in.
+    // Like the keypad's event queue, only the first KEY_QUEUE_SIZE changes in
+    // a frame are kept for it.
+    memset(b->key_events, 0, b->size * sizeof(*b->key_events));
+    memset(b->num_releases, 0, b->size * sizeof(*b->num_releases));
+    memset(b->next_release, 0, b->size * sizeof(*b->next_release));
+    const input_event_t *event;
+    while ((event = next_input_event(frame)))
+    {
+        const size_t i = event->instance;
+        const uint16_t bit = (1 << event->key);
+        b->keypad[i] =
+            event->down ? (b->keypad[i] | bit) : (b->keypad[i] & ~bit);
+        if (b->key_events[i] == KEY_QUEUE_SIZE) continue;
+        b->key_events[i]++;
+        if (!event->down)
+        {
+            b->releases[i*KEY_QUEUE_SIZE + b->num_releases[i]++] = event->key;
+        }
+    }
+}
+
+/*
+ * Report each instance's display with the same hash as `--hash-frames`, so an
+ * instance can be checked against a headless run with its seed.
+ */
+static void report(const batch_t *b)
+{
+    static display_t display;
+    memset(&display, 0, sizeof(display));
+    display.width = DISPLAY_WIDTH;
+    display.height = DISPLAY_HEIGHT;
+    for (size_t i = 0; i < b->size; i++)
+    {
+        for (size_t row = 0; row < DISPLAY_HEIGHT; row++)
+        {
+            display.rows[0][row][0] = b->display[i*DISPLAY_HEIGHT + row];
+        }
+        printf(
+            "Instance %zu: PC %03x  Display %016llx%s\n",
+            i, b->program_counter[i],
+            (unsigned long long)hash_display(&display),
+            b->halted[i] ? "  (halted)" : ""
+        );
+    }
+}
+
+void *batch_fn(__attribute__ ((unused)) void *p)
+{
+    batch_t b;
+    batch_init(&b, g_batch_size);
+
+    size_t frame = 0;
+    size_t halted = 0;
+    while (!g_io_done && (halted < b.size))
+    {
+        apply_input(&b, frame);
+        memset(b.end_of_frame, 0, b.size);
+        b.skipped = 0;
+        b.running_known = 0;
+        size_t count = 0;
+        for (b.step = 0; b.step < g_ipf; b.step++)
+        {
+            const size_t executed = step(&b);
+            if (!executed) break;
+            count += executed;
+        }
+        count += b.skipped;
+
+        halted = 0;
+        for (size_t i = 0; i < b.size; i++)
+        {
+            b.delay_timer[i] -= (b.delay_timer[i] > 0);
+            b.sound_timer[i] -= (b.sound_timer[i] > 0);
+            halted += b.halted[i];
+        }
+        pace_headless_frame(count);
+        frame++;
+    }
+
+    report(&b);
+    if (halted) g_cpu_error = 1;
+    batch_quit(&b);
+    pthread_exit(NULL);
+}
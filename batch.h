@@ -0,0 +1,9 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+extern size_t g_batch_size;
+extern void *batch_fn(void *p);
+
+#endif // BATCH_H
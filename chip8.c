@@ -9,15 +9,47 @@
 #include <string.h>
 #include <time.h>
 
+#ifdef AOT
+#include "aot.h"
+#endif
 #include "chip8.h"
 #include "draw.h"
+#include "headless.h"
 #include "io.h"
+#include "keypad.h"
+#include "latency.h"
 #include "load.h"
+#include "profile.h"
 #include "terminal.h"
 #include "timer.h"
 
 volatile uint8_t g_cpu_done = 0;
+volatile uint8_t g_cpu_error = 0;
 volatile uint8_t g_in_fx0a = 0;
+size_t g_ipf = 10; // instructions per frame (atomic, set by [ and ])
+#ifdef COSMAC_VIP
+uint8_t g_display_wait = 1; // end the frame after drawing or clearing
+#else
+uint8_t g_display_wait = 0;
+#endif
+#ifdef AOT
+uint8_t g_aot_valid = 0; // 0 if the translated code must not be run
+#endif
+uint32_t g_seed = 0;    // of the random number generator
+uint8_t g_seed_set = 0; // 0 if a window picks a seed from the clock
+engine_t g_engine = ENGINE_BLOCK;
+const char *g_engine_names[] =
+{
+    "interpreter",
+    "block",
+#ifdef THREADED_DISPATCH
+    "threaded",
+#endif
+#ifdef AOT
+    "aot",
+#endif
+};
+const size_t NUM_ENGINES = (sizeof(g_engine_names)/sizeof(g_engine_names[0]));
 
 static const int8_t MAX_STACK_INDEX = (STACK_SIZE-1);
 
@@ -31,15 +63,45 @@ static void handle_error(
         "[ERROR] %s (Memory[0x%03x]: 0x%04x)\n",
         message, bad_address, instruction
     );
+    g_cpu_error = 1;
     g_cpu_done = 1;
     pthread_exit(NULL);
 }
 
-static void undefined_instruction(chip8_t *c8, const uint16_t instruction)
+/*
+ * Stop if the program counter has run off the end of memory, where there is no
+ * whole instruction left to fetch.
+ */
+static inline void check_instruction_address(const size_t address)
+{
+    if (address >= (MEMORY_SIZE-1))
+    {
+        handle_error("Program counter is out of range", address, 0x0000);
+    }
+}
+
+/*
+ * Stop before an instruction reads or writes `size` bytes from I that run past
+ * the end of memory.
+ */
+static inline void check_memory_access(
+    const chip8_t *c8, const decoded_t *d, const size_t size
+)
+{
+    if (((size_t)c8->I + size) > MEMORY_SIZE)
+    {
+        handle_error(
+            "Memory access is out of range",
+            c8->program_counter-2, d->instruction
+        );
+    }
+}
+
+static void undefined_instruction(chip8_t *c8, const decoded_t *d)
 {
     handle_error(
         "Encountered undefined instruction",
-        c8->program_counter-2, instruction
+        c8->program_counter-2, d->instruction
     );
 }
 
@@ -48,569 +110,1306 @@ static inline void advance_program_counter(chip8_t *c8)
     c8->program_counter += 2;
 }
 
-static void execute_0nnn(chip8_t *c8, const uint16_t instruction)
+/*
+ * Skip the next instruction.
+ */
+static inline void skip_instruction(chip8_t *c8)
 {
-#ifdef LEGACY
-    const uint16_t address = (instruction & 0x0fff);
+    c8->program_counter +=
+        instruction_length(c8->memory, c8->program_counter);
+}
+
+/*
+ * Drop the decoded instructions and blocks that overlap the given range of
+ * memory, so that they are rebuilt the next time they are executed. An
+ * instruction that starts one byte before the range also overlaps it, and so
+ * does any block that starts less than `MAX_BLOCK_SIZE` instructions before it.
+ * A block may also end in a superinstruction that reaches up to
+ * `MAX_FUSED_SIZE-1` instructions past its end.
+ */
+static void invalidate_decode_cache(
+    chip8_t *c8, const uint16_t address, const size_t size
+)
+{
+    const size_t first = (address > 0) ? (address-1) : 0;
+    if (first >= MEMORY_SIZE) return; // nothing in memory was written
+    size_t last = (address + size);
+    if (last > MEMORY_SIZE) last = MEMORY_SIZE;
+    for (size_t i = first; i < last; i++)
+    {
+        c8->decode_cache[i].execute = NULL;
+    }
+
+    const size_t block_reach = 2*((MAX_BLOCK_SIZE-1) + (MAX_FUSED_SIZE-1));
+    const size_t first_block = (first > block_reach) ? (first-block_reach) : 0;
+    memset(&c8->block_size[first_block], 0, last-first_block);
+
+#ifdef AOT
+    // Self-modifying code: the translated code no longer matches memory
+    for (size_t i = address; i < last; i++)
+    {
+        if (AOT_CODE_MAP[i]) g_aot_valid = 0;
+    }
 #endif
-    switch (instruction)
+}
+
+static void execute_00e0(
+    chip8_t *c8, __attribute__ ((unused)) const decoded_t *d
+)
+{
+    // Clear display, waiting for the next frame like a sprite draw
+    clear_display();
+    if (g_display_wait)
     {
-        case 0x00e0:
-            clear_display();
-            break;
-        case 0x00ee:
-            // Return from subroutine
-            if (c8->stack_pointer == -1)
-            {
-                handle_error(
-                    "Trying to decrement stack pointer beyond limit",
-                    c8->program_counter-2, instruction
-                );
-            }
-            c8->program_counter = c8->stack[c8->stack_pointer];
-            c8->stack_pointer--;
-            break;
-        default:
+        c8->end_of_frame = 1;
+        PROFILE_FRAME_END(WAIT_CLEAR_DISPLAY);
+    }
+}
+
+static void execute_00ee(chip8_t *c8, const decoded_t *d)
+{
+    // Return from subroutine
+    if (c8->stack_pointer == -1)
+    {
+        handle_error(
+            "Trying to decrement stack pointer beyond limit",
+            c8->program_counter-2, d->instruction
+        );
+    }
+    c8->program_counter = c8->stack[c8->stack_pointer];
+    c8->stack_pointer--;
+}
+
 #ifdef LEGACY
-            // Jump to machine code routine
-            c8->program_counter = address;
-#else
-            undefined_instruction(c8, instruction);
+static void execute_0nnn(chip8_t *c8, const decoded_t *d)
+{
+    // Jump to machine code routine
+    c8->program_counter = d->nnn;
+}
 #endif
-            break;
-    }
+
+#ifdef SUPER_CHIP
+static void execute_00cn(
+    __attribute__ ((unused)) chip8_t *c8, const decoded_t *d
+)
+{
+    // Scroll display down by n rows
+    scroll_display_down(d->n);
+}
+
+static void execute_00fb(
+    __attribute__ ((unused)) chip8_t *c8,
+    __attribute__ ((unused)) const decoded_t *d
+)
+{
+    // Scroll display right by 4 pixels
+    scroll_display_right();
 }
 
-static void execute_1nnn(chip8_t *c8, const uint16_t instruction)
+static void execute_00fc(
+    __attribute__ ((unused)) chip8_t *c8,
+    __attribute__ ((unused)) const decoded_t *d
+)
+{
+    // Scroll display left by 4 pixels
+    scroll_display_left();
+}
+
+static void execute_00fe(
+    __attribute__ ((unused)) chip8_t *c8,
+    __attribute__ ((unused)) const decoded_t *d
+)
+{
+    // Low resolution (64x32)
+    set_high_resolution(0);
+}
+
+static void execute_00ff(
+    __attribute__ ((unused)) chip8_t *c8,
+    __attribute__ ((unused)) const decoded_t *d
+)
+{
+    // High resolution (128x64)
+    set_high_resolution(1);
+}
+#endif
+
+static void execute_1nnn(chip8_t *c8, const decoded_t *d)
 {
     // Jump to address
-    const uint16_t address = (instruction & 0x0fff);
-    if (address < PROGRAM_START)
+    if (d->nnn < PROGRAM_START)
     {
-        handle_error(DEST_ADDR_OOR, c8->program_counter-2, instruction);
+        handle_error(DEST_ADDR_OOR, c8->program_counter-2, d->instruction);
     }
-    c8->program_counter = address;
+    c8->program_counter = d->nnn;
 }
 
-static void execute_2nnn(chip8_t *c8, const uint16_t instruction)
+static void execute_2nnn(chip8_t *c8, const decoded_t *d)
 {
     // Call subroutine
     if (c8->stack_pointer == MAX_STACK_INDEX)
     {
         handle_error(
             "Trying to increment stack pointer beyond limit",
-            c8->program_counter-2, instruction
+            c8->program_counter-2, d->instruction
         );
     }
-    const uint16_t address = (instruction & 0x0fff);
-    if (address < PROGRAM_START)
+    if (d->nnn < PROGRAM_START)
     {
-        handle_error(DEST_ADDR_OOR, c8->program_counter-2, instruction);
+        handle_error(DEST_ADDR_OOR, c8->program_counter-2, d->instruction);
     }
     c8->stack_pointer++;
     c8->stack[c8->stack_pointer] = c8->program_counter;
-    c8->program_counter = address;
+    c8->program_counter = d->nnn;
 }
 
-static void execute_3xnn(chip8_t *c8, const uint16_t instruction)
+static void execute_3xnn(chip8_t *c8, const decoded_t *d)
 {
     // Skip next instruction if Vx == byte
-    if (c8->V[(instruction & 0x0f00) >> 8] == (instruction & 0x00ff))
+    if (c8->V[d->x] == d->nn)
     {
-        advance_program_counter(c8);
+        skip_instruction(c8);
     }
 }
 
-static void execute_4xnn(chip8_t *c8, const uint16_t instruction)
+static void execute_4xnn(chip8_t *c8, const decoded_t *d)
 {
     // Skip next instruction if Vx != byte
-    if (c8->V[(instruction & 0x0f00) >> 8] != (instruction & 0x00ff))
+    if (c8->V[d->x] != d->nn)
     {
-        advance_program_counter(c8);
+        skip_instruction(c8);
     }
 }
 
-static void execute_5xy0(chip8_t *c8, const uint16_t instruction)
+static void execute_5xy0(chip8_t *c8, const decoded_t *d)
 {
     // Skip next instruction if Vx == Vy
-    if (
-        c8->V[(instruction & 0x0f00) >> 8] == c8->V[(instruction & 0x00f0) >> 4]
-    )
+    if (c8->V[d->x] == c8->V[d->y])
     {
-        advance_program_counter(c8);
+        skip_instruction(c8);
     }
 }
 
-static void execute_6xnn(chip8_t *c8, const uint16_t instruction)
+static void execute_6xnn(chip8_t *c8, const decoded_t *d)
 {
     // Vx = byte
-    c8->V[(instruction & 0x0f00) >> 8] = (instruction & 0x00ff);
+    c8->V[d->x] = d->nn;
 }
 
-static void execute_7xnn(chip8_t *c8, const uint16_t instruction)
+static void execute_7xnn(chip8_t *c8, const decoded_t *d)
 {
     // Vx += byte
-    c8->V[(instruction & 0x0f00) >> 8] += (instruction & 0x00ff);
+    c8->V[d->x] += d->nn;
 }
 
-static void execute_8xy0(chip8_t *c8, const uint16_t instruction)
+static void execute_8xy0(chip8_t *c8, const decoded_t *d)
 {
     // Vx = Vy
-    c8->V[(instruction & 0x0f00) >> 8] = c8->V[(instruction & 0x00f0) >> 4];
+    c8->V[d->x] = c8->V[d->y];
 }
 
-static void execute_8xy1(chip8_t *c8, const uint16_t instruction)
+static void execute_8xy1(chip8_t *c8, const decoded_t *d)
 {
     // Vx |= Vy
-    c8->V[(instruction & 0x0f00) >> 8] |= c8->V[(instruction & 0x00f0) >> 4];
+    c8->V[d->x] |= c8->V[d->y];
     c8->V[0xf] = 0x00;
 }
 
-static void execute_8xy2(chip8_t *c8, const uint16_t instruction)
+static void execute_8xy2(chip8_t *c8, const decoded_t *d)
 {
     // Vx &= Vy
-    c8->V[(instruction & 0x0f00) >> 8] &= c8->V[(instruction & 0x00f0) >> 4];
+    c8->V[d->x] &= c8->V[d->y];
     c8->V[0xf] = 0x00;
 }
 
-static void execute_8xy3(chip8_t *c8, const uint16_t instruction)
+static void execute_8xy3(chip8_t *c8, const decoded_t *d)
 {
     // Vx ^= Vy
-    c8->V[(instruction & 0x0f00) >> 8] ^= c8->V[(instruction & 0x00f0) >> 4];
+    c8->V[d->x] ^= c8->V[d->y];
     c8->V[0xf] = 0x00;
 }
 
-static void execute_8xy4(chip8_t *c8, const uint16_t instruction)
+static void execute_8xy4(chip8_t *c8, const decoded_t *d)
 {
     // Vx += Vy
-    const uint8_t x = ((instruction & 0x0f00) >> 8);
-    const uint8_t before = c8->V[x];
-    c8->V[x] += c8->V[(instruction & 0x00f0) >> 4];
-    c8->V[0xf] = (c8->V[x] < before) ? 1 : 0;
+    const uint8_t before = c8->V[d->x];
+    c8->V[d->x] += c8->V[d->y];
+    c8->V[0xf] = (c8->V[d->x] < before) ? 1 : 0;
 }
 
-static void execute_8xy5(chip8_t *c8, const uint16_t instruction)
+static void execute_8xy5(chip8_t *c8, const decoded_t *d)
 {
     // Vx -= Vy
-    const uint8_t x = ((instruction & 0x0f00) >> 8);
-    const uint8_t before = c8->V[x];
-    c8->V[x] -= c8->V[(instruction & 0x00f0) >> 4];
-    c8->V[0xf] = (c8->V[x] > before) ? 0 : 1;
+    const uint8_t before = c8->V[d->x];
+    c8->V[d->x] -= c8->V[d->y];
+    c8->V[0xf] = (c8->V[d->x] > before) ? 0 : 1;
 }
 
-static void execute_8xy6(chip8_t *c8, const uint16_t instruction)
+static void execute_8xy6(chip8_t *c8, const decoded_t *d)
 {
 #ifdef COSMAC_VIP
     // Vx = (Vy >>= 1)
-    const uint8_t y = ((instruction & 0x00f0) >> 4);
-    const uint8_t flag = (c8->V[y] & 0x01);
-    c8->V[y] >>= 1;
-    c8->V[(instruction & 0x0f00) >> 8] = c8->V[y];
+    const uint8_t flag = (c8->V[d->y] & 0x01);
+    c8->V[d->y] >>= 1;
+    c8->V[d->x] = c8->V[d->y];
     c8->V[0xf] = flag;
 #else
     // Vx >>= 1
-    const uint8_t x = ((instruction & 0x0f00) >> 8);
-    const uint8_t flag = (c8->V[x] & 0x01);
-    c8->V[x] >>= 1;
+    const uint8_t flag = (c8->V[d->x] & 0x01);
+    c8->V[d->x] >>= 1;
     c8->V[0xf] = flag;
 #endif
 }
 
-static void execute_8xy7(chip8_t *c8, const uint16_t instruction)
+static void execute_8xy7(chip8_t *c8, const decoded_t *d)
 {
     // Vx = (Vy - Vx)
-    const uint8_t x = ((instruction & 0x0f00) >> 8);
-    const uint8_t y = ((instruction & 0x00f0) >> 4);
-    c8->V[x] = (c8->V[y] - c8->V[x]);
-    c8->V[0xf] = (c8->V[x] > c8->V[y]) ? 0 : 1;
+    c8->V[d->x] = (c8->V[d->y] - c8->V[d->x]);
+    c8->V[0xf] = (c8->V[d->x] > c8->V[d->y]) ? 0 : 1;
 }
 
-static void execute_8xye(chip8_t *c8, const uint16_t instruction)
+static void execute_8xye(chip8_t *c8, const decoded_t *d)
 {
 #ifdef COSMAC_VIP
     // Vx = (Vy <<= 1)
-    const uint8_t y = ((instruction & 0x00f0) >> 4);
-    const uint8_t flag = ((c8->V[y] & 0x80) >> 7);
-    c8->V[y] <<= 1;
-    c8->V[(instruction & 0x0f00) >> 8] = c8->V[y];
+    const uint8_t flag = ((c8->V[d->y] & 0x80) >> 7);
+    c8->V[d->y] <<= 1;
+    c8->V[d->x] = c8->V[d->y];
     c8->V[0xf] = flag;
 #else
     // Vx <<= 1
-    const uint8_t x = ((instruction & 0x0f00) >> 8);
-    const uint8_t flag = ((c8->V[x] & 0x80) >> 7);
-    c8->V[x] <<= 1;
+    const uint8_t flag = ((c8->V[d->x] & 0x80) >> 7);
+    c8->V[d->x] <<= 1;
     c8->V[0xf] = flag;
 #endif
 }
 
-static void (* const g_execute_8nnn[16])(chip8_t*, const uint16_t) = 
-{
-    execute_8xy0,
-    execute_8xy1,
-    execute_8xy2,
-    execute_8xy3,
-    execute_8xy4,
-    execute_8xy5,
-    execute_8xy6,
-    execute_8xy7,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    execute_8xye,
-    undefined_instruction,
-};
-
-static void execute_8nnn(chip8_t *c8, const uint16_t instruction)
-{
-    (g_execute_8nnn[instruction & 0x000f])(c8, instruction);
-}
-
-static void execute_9xy0(chip8_t *c8, const uint16_t instruction)
+static void execute_9xy0(chip8_t *c8, const decoded_t *d)
 {
     // Skip next instruction if Vx != Vy
-    if (
-        c8->V[(instruction & 0x0f00) >> 8] != c8->V[(instruction & 0x00f0) >> 4]
-    )
+    if (c8->V[d->x] != c8->V[d->y])
     {
-        advance_program_counter(c8);
+        skip_instruction(c8);
     }
 }
 
-static void execute_annn(chip8_t *c8, const uint16_t instruction)
+static void execute_annn(chip8_t *c8, const decoded_t *d)
 {
     // Set I
-    c8->I = (instruction & 0x0fff);
+    c8->I = d->nnn;
 }
 
-static void execute_bnnn(chip8_t *c8, const uint16_t instruction)
+static void execute_bnnn(chip8_t *c8, const decoded_t *d)
 {
 #ifdef COSMAC_VIP
     // Jump to address + V0
-    const uint16_t address = c8->V[0x0] + (instruction & 0x0fff);
+    const size_t address = c8->V[0x0] + d->nnn;
 #else
     // Jump to address + Vx
-    const uint16_t address =
-        c8->V[(instruction & 0x0f00) >> 8] + (instruction & 0x0fff);
+    const size_t address = c8->V[d->x] + d->nnn;
 #endif
     if ((address < PROGRAM_START) || (address >= MEMORY_SIZE))
     {
-        handle_error(DEST_ADDR_OOR, c8->program_counter-2, instruction);
+        handle_error(DEST_ADDR_OOR, c8->program_counter-2, d->instruction);
     }
     c8->program_counter = address;
 }
 
-static void execute_cxnn(chip8_t *c8, const uint16_t instruction)
+static void execute_cxnn(chip8_t *c8, const decoded_t *d)
 {
     // Vx = random
-    c8->V[(instruction & 0x0f00) >> 8] =
-        ((rand() % 0x100) & (instruction & 0x00ff));
+    c8->V[d->x] = (next_random(&c8->random_state) & d->nn);
 }
 
-static void execute_dxyn(chip8_t *c8, const uint16_t instruction)
+static void execute_dxyn(chip8_t *c8, const decoded_t *d)
 {
     // Draw sprite
+    LATENCY(latency_draw());
+    check_memory_access(c8, d, sprite_data_size(d->n));
     c8->V[0xf] = draw_sprite(
-        c8->V[(instruction & 0x00f0) >> 4],
-        c8->V[(instruction & 0x0f00) >> 8],
+        c8->V[d->y],
+        c8->V[d->x],
         &c8->memory[c8->I],
-        instruction & 0x000f
+        d->n
     );
+
+    // The COSMAC VIP waits for the vertical blank interrupt when it draws, so
+    // at most one sprite is drawn per frame.
+    if (g_display_wait)
+    {
+        c8->end_of_frame = 1;
+        PROFILE_FRAME_END(WAIT_DRAW_SPRITE);
+    }
 }
 
-static void execute_ex9e(chip8_t *c8, const uint16_t instruction)
+#ifdef SUPER_CHIP
+static void execute_dxy0(chip8_t *c8, const decoded_t *d)
 {
-    // Skip next instruction if key in Vx is pressed
-    if ((instruction & 0x00f0) != 0x0090)
+    // Draw 16x16 sprite
+    LATENCY(latency_draw());
+    check_memory_access(c8, d, sprite_data_size(32));
+    c8->V[0xf] = draw_large_sprite(
+        c8->V[d->y],
+        c8->V[d->x],
+        &c8->memory[c8->I]
+    );
+    if (g_display_wait)
     {
-        undefined_instruction(c8, instruction);
+        c8->end_of_frame = 1;
+        PROFILE_FRAME_END(WAIT_DRAW_SPRITE);
     }
-    if (g_keystate[g_keymap[c8->V[(instruction & 0x0f00) >> 8]]])
+}
+#endif
+
+static void execute_ex9e(chip8_t *c8, const decoded_t *d)
+{
+    // Skip next instruction if key in Vx is pressed
+    LATENCY(latency_read(c8->V[d->x]));
+    if (KEY_PRESSED(c8->V[d->x]))
     {
-        advance_program_counter(c8);
+        skip_instruction(c8);
     }
 }
 
-static void execute_exa1(chip8_t *c8, const uint16_t instruction)
+static void execute_exa1(chip8_t *c8, const decoded_t *d)
 {
     // Skip next instruction if key in Vx is not pressed
-    if ((instruction & 0x00f0) != 0x00a0)
+    LATENCY(latency_read(c8->V[d->x]));
+    if (!KEY_PRESSED(c8->V[d->x]))
+    {
+        skip_instruction(c8);
+    }
+}
+
+/*
+ * Programs usually wait for the delay timer in a loop of `Fx07`, a skip on Vx,
+ * and a jump back to the `Fx07`. The delay timer does not change within a
+ * frame, so once such a loop is known to go around again, it would only spin
+ * until the end of the frame. Returns 1 if the `Fx07` that was just executed
+ * starts such a loop.
+ */
+static int is_idle_loop(const chip8_t *c8, const decoded_t *d)
+{
+    const uint16_t start = (c8->program_counter-2);
+    if ((start + 6) > MEMORY_SIZE) return 0;
+    const uint8_t *next = &c8->memory[c8->program_counter];
+    const uint16_t skip = ((next[0] << 8) | next[1]);
+    const uint16_t jump = ((next[2] << 8) | next[3]);
+    if ((jump != (0x1000 | start)) || (((skip & 0x0f00) >> 8) != d->x))
     {
-        undefined_instruction(c8, instruction);
+        return 0;
     }
-    if (!g_keystate[g_keymap[c8->V[(instruction & 0x0f00) >> 8]]])
+    switch (skip >> 12)
     {
-        advance_program_counter(c8);
+        case 0x3: return (c8->V[d->x] != (skip & 0x00ff));
+        case 0x4: return (c8->V[d->x] == (skip & 0x00ff));
     }
+    return 0;
 }
 
-static void (* const g_execute_exnn[16])(chip8_t*, const uint16_t) = 
+static void execute_fx07(chip8_t *c8, const decoded_t *d)
 {
-    undefined_instruction,
-    execute_exa1,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    execute_ex9e,
-    undefined_instruction,
-};
+    // Vx = delay timer
+    c8->V[d->x] = __atomic_load_n(&g_delay_timer, __ATOMIC_RELAXED);
 
-static void execute_ennn(chip8_t *c8, const uint16_t instruction)
-{
-    (g_execute_exnn[instruction & 0x000f])(c8, instruction);
+    if (is_idle_loop(c8, d))
+    {
+        c8->idle_loop = (c8->program_counter-2);
+        c8->end_of_frame = 1;
+    }
 }
 
-static void execute_fx07(chip8_t *c8, const uint16_t instruction)
+/*
+ * Take queued key events until one releases a key, and return that key. Returns
+ * 0xff if no queued event releases a key.
+ */
+static uint8_t take_key_release()
 {
-    // Vx = delay timer
-    if ((instruction & 0x00f0) != 0x0000)
+    key_event_t event;
+    while (next_key_event(&event))
     {
-        undefined_instruction(c8, instruction);
+        if (!event.down) return event.key;
     }
-    pthread_mutex_lock(&g_timer_mutex);
-    c8->V[(instruction & 0x0f00) >> 8] = g_delay_timer;
-    pthread_mutex_unlock(&g_timer_mutex);
+    return 0xff;
 }
 
-static void execute_fx0a(chip8_t *c8, const uint16_t instruction)
+static void execute_fx0a(chip8_t *c8, const decoded_t *d)
 {
     // Wait for key press
-    if ((instruction & 0x00f0) != 0x0000)
-    {
-        undefined_instruction(c8, instruction);
-    }
-    pthread_mutex_lock(&g_input_mutex);
-    if (!(g_io_done || g_restart || g_pause))
+    uint8_t key = take_key_release();
+    if ((key == 0xff) && !g_headless)
     {
+        PROFILE_WAIT_BEGIN();
+        pthread_mutex_lock(&g_input_mutex);
         g_in_fx0a = 1;
-        pthread_cond_wait(&g_input_cond, &g_input_mutex);
+        while (
+            ((key = take_key_release()) == 0xff) &&
+            !(g_io_done || g_restart || g_pause)
+        )
+        {
+            pthread_cond_wait(&g_input_cond, &g_input_mutex);
+        }
         g_in_fx0a = 0;
-        c8->V[(instruction & 0x0f00) >> 8] = g_key_released;
+        pthread_mutex_unlock(&g_input_mutex);
+        PROFILE_WAIT_END(WAIT_FX0A);
     }
-    pthread_mutex_unlock(&g_input_mutex);
+    if (key == 0xff)
+    {
+        // Redo the wait in the next frame: the user interface interrupted it,
+        // or, in headless mode, no input script released a key in this one.
+        c8->program_counter -= 2;
+        c8->end_of_frame = 1;
+        return;
+    }
+    LATENCY(latency_read(key));
+    c8->V[d->x] = key;
 }
 
-static void execute_fx15(chip8_t *c8, const uint16_t instruction)
+static void execute_fx15(chip8_t *c8, const decoded_t *d)
 {
     // Delay timer = Vx
-    if ((instruction & 0x00f0) != 0x0010)
-    {
-        undefined_instruction(c8, instruction);
-    }
-    pthread_mutex_lock(&g_timer_mutex);
-    g_delay_timer = c8->V[(instruction & 0x0f00) >> 8];
-    pthread_mutex_unlock(&g_timer_mutex);
+    __atomic_store_n(&g_delay_timer, c8->V[d->x], __ATOMIC_RELAXED);
 }
 
-static void execute_fx18(chip8_t *c8, const uint16_t instruction)
+static void execute_fx18(chip8_t *c8, const decoded_t *d)
 {
     // Sound timer = Vx
-    if ((instruction & 0x00f0) != 0x0010)
-    {
-        undefined_instruction(c8, instruction);
-    }
-    const uint8_t duration = c8->V[(instruction & 0x0f00) >> 8];
+    const uint8_t duration = c8->V[d->x];
     if (duration < 0x02) return;
-    pthread_mutex_lock(&g_timer_mutex);
-    g_sound_timer = duration;
-    pthread_mutex_unlock(&g_timer_mutex);
+    __atomic_store_n(&g_sound_timer, duration, __ATOMIC_RELAXED);
 }
 
-static void execute_fx1e(chip8_t *c8, const uint16_t instruction)
+static void execute_fx1e(chip8_t *c8, const decoded_t *d)
 {
     // I += Vx
-    if ((instruction & 0x00f0) != 0x0010)
-    {
-        undefined_instruction(c8, instruction);
-    }
-    c8->I += c8->V[(instruction & 0x0f00) >> 8];
+    c8->I += c8->V[d->x];
 }
 
-static void execute_fx29(chip8_t *c8, const uint16_t instruction)
+static void execute_fx29(chip8_t *c8, const decoded_t *d)
 {
     // I = sprite address
-    if ((instruction & 0x00f0) != 0x0020)
-    {
-        undefined_instruction(c8, instruction);
-    }
-    c8->I =
-        FONT_START +
-        FONT_SIZE*(c8->V[(instruction & 0x0f00) >> 8] & 0x0f);
+    c8->I = FONT_START + FONT_SIZE*(c8->V[d->x] & 0x0f);
+}
+
+#ifdef SUPER_CHIP
+static void execute_fx30(chip8_t *c8, const decoded_t *d)
+{
+    // I = large sprite address
+    c8->I = BIG_FONT_START + BIG_FONT_SIZE*(c8->V[d->x] & 0x0f);
 }
+#endif
 
-static void execute_fx33(chip8_t *c8, const uint16_t instruction)
+#ifdef XO_CHIP
+static void execute_f000(
+    chip8_t *c8, __attribute__ ((unused)) const decoded_t *d
+)
+{
+    // I = 16-bit address, from the next two bytes
+    const uint8_t *next = &c8->memory[c8->program_counter];
+    c8->I = ((next[0] << 8) | next[1]);
+    advance_program_counter(c8);
+}
+
+static void execute_fn01(
+    __attribute__ ((unused)) chip8_t *c8, const decoded_t *d
+)
+{
+    // Select bitplanes n
+    select_planes(d->x);
+}
+
+static void execute_f002(chip8_t *c8, const decoded_t *d)
+{
+    // Load audio pattern from memory
+    check_memory_access(c8, d, 16);
+    set_audio_pattern(&c8->memory[c8->I]);
+}
+
+static void execute_fx3a(chip8_t *c8, const decoded_t *d)
+{
+    // Audio pitch = Vx
+    set_audio_pitch(c8->V[d->x]);
+}
+#endif
+
+static void execute_fx33(chip8_t *c8, const decoded_t *d)
 {
     // Store Vx in binary-coded decimal
-    if ((instruction & 0x00f0) != 0x0030)
-    {
-        undefined_instruction(c8, instruction);
-    }
-    uint8_t x = c8->V[(instruction & 0x0f00) >> 8];
+    check_memory_access(c8, d, 3);
+    uint8_t x = c8->V[d->x];
     c8->memory[c8->I+2] = (x % 10);
     x /= 10;
     c8->memory[c8->I+1] = (x % 10);
     x /= 10;
     c8->memory[c8->I] = (x % 10);
+    invalidate_decode_cache(c8, c8->I, 3);
 }
 
-static void execute_fx55(chip8_t *c8, const uint16_t instruction)
+static void execute_fx55(chip8_t *c8, const decoded_t *d)
 {
     // Store registers
-    if ((instruction & 0x00f0) != 0x0050)
-    {
-        undefined_instruction(c8, instruction);
-    }
-    const uint16_t num_registers = (((instruction & 0x0f00) >> 8) + 1);
+    const uint16_t num_registers = (d->x + 1);
+    check_memory_access(c8, d, num_registers);
     memcpy(&c8->memory[c8->I], c8->V, num_registers);
+    invalidate_decode_cache(c8, c8->I, num_registers);
     c8->I += num_registers;
 }
 
-static void execute_fx65(chip8_t *c8, const uint16_t instruction)
+static void execute_fx65(chip8_t *c8, const decoded_t *d)
 {
     // Load registers
-    if ((instruction & 0x00f0) != 0x0060)
-    {
-        undefined_instruction(c8, instruction);
-    }
-    const uint16_t num_registers = (((instruction & 0x0f00) >> 8) + 1);
+    const uint16_t num_registers = (d->x + 1);
+    check_memory_access(c8, d, num_registers);
     memcpy(c8->V, &c8->memory[c8->I], num_registers);
     c8->I += num_registers;
 }
 
-static void (* const g_execute_fxn5[16])(chip8_t*, const uint16_t) = 
+/*
+ * Superinstructions: handlers for common sequences of instructions, which the
+ * block engine runs with a single dispatch. Like the other handlers, they are
+ * called with the program counter past the first instruction, and they move it
+ * past each of the others in turn. They return the number of instructions that
+ * were executed, which is fewer if a skip was taken.
+ */
+static size_t execute_3xnn_1nnn(chip8_t *c8, const decoded_t *d)
 {
-    undefined_instruction,
-    execute_fx15,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    execute_fx55,
-    execute_fx65,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-    undefined_instruction,
-};
+    // Jump to address unless Vx == byte
+    advance_program_counter(c8);
+    if (c8->V[d->x] == d->nn) return 1;
+    execute_1nnn(c8, &d[2]);
+    return 2;
+}
 
-static void execute_fxn5(chip8_t *c8, const uint16_t instruction)
+static size_t execute_4xnn_1nnn(chip8_t *c8, const decoded_t *d)
 {
-    (g_execute_fxn5[(instruction & 0x00f0) >> 4])(c8, instruction);
+    // Jump to address unless Vx != byte
+    advance_program_counter(c8);
+    if (c8->V[d->x] != d->nn) return 1;
+    execute_1nnn(c8, &d[2]);
+    return 2;
 }
 
-static void (* const g_execute_fxnn[16])(chip8_t*, const uint16_t) = 
+static size_t execute_7xnn_3xnn_1nnn(chip8_t *c8, const decoded_t *d)
 {
+    // Loop counter
+    execute_7xnn(c8, d);
+    advance_program_counter(c8);
+    return 1 + execute_3xnn_1nnn(c8, &d[2]);
+}
+
+static size_t execute_7xnn_4xnn_1nnn(chip8_t *c8, const decoded_t *d)
+{
+    // Loop counter
+    execute_7xnn(c8, d);
+    advance_program_counter(c8);
+    return 1 + execute_4xnn_1nnn(c8, &d[2]);
+}
+
+static size_t execute_fx07_3xnn_1nnn(chip8_t *c8, const decoded_t *d)
+{
+    // Delay timer polling loop
+    execute_fx07(c8, d);
+    advance_program_counter(c8);
+    return 1 + execute_3xnn_1nnn(c8, &d[2]);
+}
+
+static size_t execute_fx07_4xnn_1nnn(chip8_t *c8, const decoded_t *d)
+{
+    // Delay timer polling loop
+    execute_fx07(c8, d);
+    advance_program_counter(c8);
+    return 1 + execute_4xnn_1nnn(c8, &d[2]);
+}
+
+static size_t execute_annn_dxyn(chip8_t *c8, const decoded_t *d)
+{
+    // Draw sprite at address
+    execute_annn(c8, d);
+    advance_program_counter(c8);
+    execute_dxyn(c8, &d[2]);
+    return 2;
+}
+
+/*
+ * Every sequence contains an instruction that ends a block, so a fused sequence
+ * always runs to the end of its block. Longer sequences come first.
+ */
+static const struct
+{
+    execute_fn sequence[MAX_FUSED_SIZE]; // NULL after the last instruction
+    fused_fn fused;
+} g_fusions[] =
+{
+    {{execute_7xnn, execute_3xnn, execute_1nnn}, execute_7xnn_3xnn_1nnn},
+    {{execute_7xnn, execute_4xnn, execute_1nnn}, execute_7xnn_4xnn_1nnn},
+    {{execute_fx07, execute_3xnn, execute_1nnn}, execute_fx07_3xnn_1nnn},
+    {{execute_fx07, execute_4xnn, execute_1nnn}, execute_fx07_4xnn_1nnn},
+    {{execute_3xnn, execute_1nnn, NULL}, execute_3xnn_1nnn},
+    {{execute_4xnn, execute_1nnn, NULL}, execute_4xnn_1nnn},
+    {{execute_annn, execute_dxyn, NULL}, execute_annn_dxyn},
+};
+
+static const execute_fn g_execute_8nnn[16] =
+{
+    execute_8xy0,
+    execute_8xy1,
+    execute_8xy2,
+    execute_8xy3,
+    execute_8xy4,
+    execute_8xy5,
+    execute_8xy6,
+    execute_8xy7,
     undefined_instruction,
     undefined_instruction,
     undefined_instruction,
-    execute_fx33,
-    undefined_instruction,
-    execute_fxn5,
-    undefined_instruction,
-    execute_fx07,
-    execute_fx18,
-    execute_fx29,
-    execute_fx0a,
     undefined_instruction,
     undefined_instruction,
     undefined_instruction,
-    execute_fx1e,
+    execute_8xye,
     undefined_instruction,
 };
 
-static void execute_fnnn(chip8_t *c8, const uint16_t instruction)
-{
-    (g_execute_fxnn[instruction & 0x000f])(c8, instruction);
-}
-
-static void (* const g_execute[16])(chip8_t*, const uint16_t) = 
-{
-    execute_0nnn,
-    execute_1nnn,
-    execute_2nnn,
-    execute_3xnn,
-    execute_4xnn,
-    execute_5xy0,
-    execute_6xnn,
-    execute_7xnn,
-    execute_8nnn,
-    execute_9xy0,
-    execute_annn,
-    execute_bnnn,
-    execute_cxnn,
-    execute_dxyn,
-    execute_ennn,
-    execute_fnnn,
-};
+static execute_fn decode_0nnn(const uint16_t instruction)
+{
+#ifdef SUPER_CHIP
+    if ((instruction & 0xfff0) == 0x00c0)
+    {
+        return execute_00cn;
+    }
+#endif
+    switch (instruction)
+    {
+        case 0x00e0:
+            return execute_00e0;
+        case 0x00ee:
+            return execute_00ee;
+#ifdef SUPER_CHIP
+        case 0x00fb:
+            return execute_00fb;
+        case 0x00fc:
+            return execute_00fc;
+        case 0x00fe:
+            return execute_00fe;
+        case 0x00ff:
+            return execute_00ff;
+#endif
+        default:
+#ifdef LEGACY
+            return execute_0nnn;
+#else
+            return undefined_instruction;
+#endif
+    }
+}
+
+static execute_fn decode_ennn(const uint16_t instruction)
+{
+    switch (instruction & 0x00ff)
+    {
+        case 0x9e:
+            return execute_ex9e;
+        case 0xa1:
+            return execute_exa1;
+        default:
+            return undefined_instruction;
+    }
+}
+
+static execute_fn decode_fnnn(const uint16_t instruction)
+{
+    switch (instruction & 0x00ff)
+    {
+#ifdef XO_CHIP
+        case 0x00:
+            if (instruction != 0xf000) return undefined_instruction;
+            return execute_f000;
+        case 0x01:
+            return execute_fn01;
+        case 0x02:
+            if (instruction != 0xf002) return undefined_instruction;
+            return execute_f002;
+#endif
+        case 0x07:
+            return execute_fx07;
+        case 0x0a:
+            return execute_fx0a;
+        case 0x15:
+            return execute_fx15;
+        case 0x18:
+            return execute_fx18;
+        case 0x1e:
+            return execute_fx1e;
+        case 0x29:
+            return execute_fx29;
+#ifdef SUPER_CHIP
+        case 0x30:
+            return execute_fx30;
+#endif
+        case 0x33:
+            return execute_fx33;
+#ifdef XO_CHIP
+        case 0x3a:
+            return execute_fx3a;
+#endif
+        case 0x55:
+            return execute_fx55;
+        case 0x65:
+            return execute_fx65;
+        default:
+            return undefined_instruction;
+    }
+}
+
+/*
+ * Decode an instruction into its handler and operands. This is done once per
+ * memory address, and the result is kept in the decode cache until the memory
+ * at that address is written to.
+ */
+static inline void extract_operands(const uint16_t instruction, decoded_t *d)
+{
+    d->instruction = instruction;
+    d->nnn = (instruction & 0x0fff);
+    d->x = ((instruction & 0x0f00) >> 8);
+    d->y = ((instruction & 0x00f0) >> 4);
+    d->nn = (instruction & 0x00ff);
+    d->n = (instruction & 0x000f);
+}
+
+static void decode(const uint16_t instruction, decoded_t *d)
+{
+    extract_operands(instruction, d);
+    switch ((instruction & 0xf000) >> 12)
+    {
+        case 0x0: d->execute = decode_0nnn(instruction); break;
+        case 0x1: d->execute = execute_1nnn; break;
+        case 0x2: d->execute = execute_2nnn; break;
+        case 0x3: d->execute = execute_3xnn; break;
+        case 0x4: d->execute = execute_4xnn; break;
+        case 0x5:
+            d->execute = (d->n == 0x0) ? execute_5xy0 : undefined_instruction;
+            break;
+        case 0x6: d->execute = execute_6xnn; break;
+        case 0x7: d->execute = execute_7xnn; break;
+        case 0x8: d->execute = g_execute_8nnn[d->n]; break;
+        case 0x9:
+            d->execute = (d->n == 0x0) ? execute_9xy0 : undefined_instruction;
+            break;
+        case 0xa: d->execute = execute_annn; break;
+        case 0xb: d->execute = execute_bnnn; break;
+        case 0xc: d->execute = execute_cxnn; break;
+        case 0xd:
+#ifdef SUPER_CHIP
+            d->execute = (d->n == 0x0) ? execute_dxy0 : execute_dxyn;
+#else
+            d->execute = execute_dxyn;
+#endif
+            break;
+        case 0xe: d->execute = decode_ennn(instruction); break;
+        case 0xf: d->execute = decode_fnnn(instruction); break;
+    }
+}
+
+static inline const decoded_t *decode_at(chip8_t *c8, const size_t address)
+{
+    check_instruction_address(address);
+    decoded_t *d = &c8->decode_cache[address];
+    if (!d->execute)
+    {
+        decode((c8->memory[address] << 8) | c8->memory[address+1], d);
+    }
+    return d;
+}
+
+static inline const decoded_t *fetch(chip8_t *c8)
+{
+    return decode_at(c8, c8->program_counter);
+}
+
+/*
+ * Instructions that may transfer control, wait, draw, or write to memory end a
+ * block. Everything before them in a block is straight-line code.
+ */
+static int ends_block(const decoded_t *d)
+{
+    static const execute_fn terminators[] =
+    {
+        execute_00e0,
+        execute_00ee,
+#ifdef LEGACY
+        execute_0nnn,
+#endif
+        execute_1nnn,
+        execute_2nnn,
+        execute_3xnn,
+        execute_4xnn,
+        execute_5xy0,
+        execute_9xy0,
+        execute_bnnn,
+        execute_dxyn,
+#ifdef SUPER_CHIP
+        execute_dxy0,
+#endif
+        execute_ex9e,
+        execute_exa1,
+#ifdef XO_CHIP
+        execute_f000, // followed by its address, not an instruction
+#endif
+        execute_fx0a,
+        execute_fx33,
+        execute_fx55,
+        undefined_instruction,
+    };
+    for (size_t i = 0; i < (sizeof(terminators)/sizeof(terminators[0])); i++)
+    {
+        if (d->execute == terminators[i]) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Find the superinstruction, if any, for the sequence of instructions that
+ * starts at the given address.
+ */
+static void fuse(chip8_t *c8, const size_t address)
+{
+    decoded_t *d = &c8->decode_cache[address];
+    d->fused_size = 0;
+    for (size_t i = 0; i < (sizeof(g_fusions)/sizeof(g_fusions[0])); i++)
+    {
+        const execute_fn *sequence = g_fusions[i].sequence;
+        size_t size = 0;
+        while ((size < MAX_FUSED_SIZE) && sequence[size])
+        {
+            const size_t next = (address + 2*size);
+            if (next >= (MEMORY_SIZE-1)) break;
+            if (decode_at(c8, next)->execute != sequence[size]) break;
+            size++;
+        }
+        if ((size == MAX_FUSED_SIZE) || (size && !sequence[size]))
+        {
+            d->fused = g_fusions[i].fused;
+            d->fused_size = size;
+            return;
+        }
+    }
+}
+
+/*
+ * Decode the block of straight-line instructions that starts at the given
+ * address, and return the number of instructions in it.
+ */
+static uint8_t build_block(chip8_t *c8, const uint16_t start)
+{
+    uint8_t size = 0;
+    size_t address = start;
+    while ((size < MAX_BLOCK_SIZE) && (address < (MEMORY_SIZE-1)))
+    {
+        size++;
+        fuse(c8, address);
+        if (ends_block(decode_at(c8, address))) break;
+        address += 2;
+    }
+    return size;
+}
+
+/*
+ * Execute the block that starts at the program counter, but no more than
+ * `budget` instructions of it. Returns the number of instructions executed.
+ */
+static size_t execute_block(chip8_t *c8, const size_t budget)
+{
+    check_instruction_address(c8->program_counter);
+    uint8_t *size = &c8->block_size[c8->program_counter];
+    if (!*size)
+    {
+        *size = build_block(c8, c8->program_counter);
+    }
+    const size_t count = (*size < budget) ? *size : budget;
+    // Only the last instruction of a block may change the flow of control, so
+    // the decoded instructions can be walked without fetching.
+    const decoded_t *d = &c8->decode_cache[c8->program_counter];
+    for (size_t i = 0; i < count; i++, d += 2)
+    {
+        if (d->fused_size && (d->fused_size <= (budget-i)))
+        {
+            advance_program_counter(c8);
+            const size_t executed = d->fused(c8, d);
+            PROFILE_DECODED(c8, d, executed);
+            return i + executed;
+        }
+        PROFILE_DECODED(c8, d, 1);
+        advance_program_counter(c8);
+        d->execute(c8, d);
+    }
+    return count;
+}
+
+/* Every handler, i.e. every class of instruction */
+#ifdef LEGACY
+#define LEGACY_OPCODE_CLASSES(X) X(execute_0nnn)
+#else
+#define LEGACY_OPCODE_CLASSES(X)
+#endif
+#ifdef SUPER_CHIP
+#define SUPER_CHIP_OPCODE_CLASSES(X) \
+    X(execute_00cn) X(execute_00fb) X(execute_00fc) X(execute_00fe) \
+    X(execute_00ff) X(execute_dxy0) X(execute_fx30)
+#else
+#define SUPER_CHIP_OPCODE_CLASSES(X)
+#endif
+#ifdef XO_CHIP
+#define XO_CHIP_OPCODE_CLASSES(X) \
+    X(execute_f000) X(execute_fn01) X(execute_f002) X(execute_fx3a)
+#else
+#define XO_CHIP_OPCODE_CLASSES(X)
+#endif
+#define OPCODE_CLASSES(X) \
+    X(undefined_instruction) \
+    X(execute_00e0) X(execute_00ee) LEGACY_OPCODE_CLASSES(X) \
+    SUPER_CHIP_OPCODE_CLASSES(X) XO_CHIP_OPCODE_CLASSES(X) \
+    X(execute_1nnn) X(execute_2nnn) X(execute_3xnn) X(execute_4xnn) \
+    X(execute_5xy0) X(execute_6xnn) X(execute_7xnn) \
+    X(execute_8xy0) X(execute_8xy1) X(execute_8xy2) X(execute_8xy3) \
+    X(execute_8xy4) X(execute_8xy5) X(execute_8xy6) X(execute_8xy7) \
+    X(execute_8xye) X(execute_9xy0) X(execute_annn) X(execute_bnnn) \
+    X(execute_cxnn) X(execute_dxyn) X(execute_ex9e) X(execute_exa1) \
+    X(execute_fx07) X(execute_fx0a) X(execute_fx15) X(execute_fx18) \
+    X(execute_fx1e) X(execute_fx29) X(execute_fx33) X(execute_fx55) \
+    X(execute_fx65)
+
+#ifdef PROFILE
+const char *opcode_class_name(const uint16_t instruction)
+{
+#define OPCODE_CLASS_NAME(handler) {handler, #handler},
+    static const struct
+    {
+        execute_fn handler;
+        const char *name;
+    } classes[] =
+    {
+        OPCODE_CLASSES(OPCODE_CLASS_NAME)
+    };
+#undef OPCODE_CLASS_NAME
+
+    static const char prefix[] = "execute_";
+    decoded_t d;
+    decode(instruction, &d);
+    for (size_t i = 0; i < (sizeof(classes)/sizeof(classes[0])); i++)
+    {
+        if (d.execute != classes[i].handler) continue;
+        const char *name = classes[i].name;
+        if (strncmp(name, prefix, sizeof(prefix)-1) == 0)
+        {
+            name += (sizeof(prefix)-1);
+        }
+        return name;
+    }
+    return "unknown";
+}
+#endif
+
+#ifdef THREADED_DISPATCH
+/*
+ * The threaded engine classifies every possible instruction ahead of time, and
+ * then dispatches each instruction with a single indirect jump to the code for
+ * its class. That code calls the same handlers as the other engines, but calls
+ * them directly, so that the compiler is able to inline them.
+ */
+static uint8_t g_opcode_class[0x10000];
+
+static void init_opcode_classes()
+{
+    static uint8_t initialized = 0;
+    if (initialized) return;
+
+#define OPCODE_CLASS_HANDLER(handler) handler,
+    static const execute_fn handlers[] =
+    {
+        OPCODE_CLASSES(OPCODE_CLASS_HANDLER)
+    };
+#undef OPCODE_CLASS_HANDLER
+
+    for (size_t instruction = 0; instruction < 0x10000; instruction++)
+    {
+        decoded_t d;
+        decode(instruction, &d);
+        for (size_t i = 0; i < (sizeof(handlers)/sizeof(handlers[0])); i++)
+        {
+            if (d.execute == handlers[i])
+            {
+                g_opcode_class[instruction] = i;
+                break;
+            }
+        }
+    }
+    initialized = 1;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic" // labels as values
+static size_t run_threaded(chip8_t *c8, const size_t budget)
+{
+#define OPCODE_CLASS_LABEL(handler) &&label_##handler,
+    static const void *labels[] =
+    {
+        OPCODE_CLASSES(OPCODE_CLASS_LABEL)
+    };
+#undef OPCODE_CLASS_LABEL
+
+    decoded_t d;
+    size_t count = 0;
+#define DISPATCH() \
+    do \
+    { \
+        if ((count == budget) || c8->end_of_frame) return count; \
+        check_instruction_address(c8->program_counter); \
+        count++; \
+        extract_operands( \
+            (c8->memory[c8->program_counter] << 8) | \
+            c8->memory[c8->program_counter+1], \
+            &d \
+        ); \
+        PROFILE_INSTRUCTION(c8->program_counter, d.instruction); \
+        advance_program_counter(c8); \
+        goto *labels[g_opcode_class[d.instruction]]; \
+    } while (0)
+
+    DISPATCH();
+
+#define OPCODE_CLASS_BODY(handler) \
+label_##handler: \
+    handler(c8, &d); \
+    DISPATCH();
+
+    OPCODE_CLASSES(OPCODE_CLASS_BODY)
+
+#undef OPCODE_CLASS_BODY
+#undef DISPATCH
+}
+#pragma GCC diagnostic pop
+#endif // THREADED_DISPATCH
+
+static size_t run_interpreter(chip8_t *c8, const size_t budget)
+{
+    size_t count = 0;
+    while ((count < budget) && !c8->end_of_frame)
+    {
+        // Fetch/Decode
+        const decoded_t *d = fetch(c8);
+        PROFILE_INSTRUCTION(c8->program_counter, d->instruction);
+
+        advance_program_counter(c8);
+
+        // Execute
+        d->execute(c8, d);
+        count++;
+    }
+    return count;
+}
+
+static size_t run_blocks(chip8_t *c8, const size_t budget)
+{
+    size_t count = 0;
+    while ((count < budget) && !c8->end_of_frame)
+    {
+        count += execute_block(c8, budget-count);
+    }
+    return count;
+}
+
+#ifdef AOT
+/*
+ * Called by the translated code for instructions that it does not implement
+ * itself. The program counter already points past the instruction.
+ */
+void aot_execute(chip8_t *c8)
+{
+    const decoded_t *d = decode_at(c8, c8->program_counter-2);
+    d->execute(c8, d);
+}
+
+/*
+ * The translated code can only be run if the program in memory is the one it
+ * was translated from.
+ */
+static uint8_t aot_matches_memory(const chip8_t *c8)
+{
+    const size_t program_size = (MEMORY_SIZE-PROGRAM_START);
+    if (AOT_ROM_SIZE > program_size) return 0;
+    if (memcmp(&c8->memory[PROGRAM_START], AOT_ROM, AOT_ROM_SIZE)) return 0;
+    for (size_t i = (PROGRAM_START+AOT_ROM_SIZE); i < MEMORY_SIZE; i++)
+    {
+        if (c8->memory[i]) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Run the translated code, and step the interpreter through any code that was
+ * not translated (e.g. the target of a computed jump). If the translated code
+ * becomes invalid, the interpreter runs the rest of the program.
+ */
+static size_t run_aot(chip8_t *c8, const size_t budget)
+{
+    size_t count = 0;
+    while ((count < budget) && !c8->end_of_frame)
+    {
+        if (!g_aot_valid)
+        {
+            return count + run_interpreter(c8, budget-count);
+        }
+        count += aot_run(c8, budget-count);
+        if ((count < budget) && !c8->end_of_frame)
+        {
+            count += run_interpreter(c8, 1);
+        }
+    }
+    return count;
+}
+#endif // AOT
+
+/*
+ * Skip the rest of a frame that would be spent in a delay timer loop (see
+ * `is_idle_loop()`). Every pass around the loop leaves the same state behind,
+ * so only the position in the loop after the remaining instructions needs to
+ * be worked out. Returns the number of instructions in the frame.
+ */
+static size_t skip_idle_loop(
+    chip8_t *c8, const size_t count, const size_t budget
+)
+{
+    const size_t offset = (c8->program_counter - c8->idle_loop);
+    if ((c8->program_counter < c8->idle_loop) || (offset > 4) || (offset & 1))
+    {
+        return count; // left the loop
+    }
+    const size_t position = ((offset/2) + (budget-count)) % 3;
+    c8->program_counter = (c8->idle_loop + 2*position);
+
+#ifdef PROFILE
+    // The skipped passes around the loop count as executed
+    for (size_t i = 0; i < 3; i++)
+    {
+        const size_t first = ((i + 3 - (offset/2)) % 3); // first skipped at i
+        if (first >= (budget-count)) continue;
+        const uint16_t address = (c8->idle_loop + 2*i);
+        PROFILE_INSTRUCTIONS(
+            address,
+            ((c8->memory[address] << 8) | c8->memory[address+1]),
+            ((budget-count) - first + 2) / 3
+        );
+    }
+#endif
+    return budget;
+}
+
+static size_t run_engine(chip8_t *c8, const size_t budget)
+{
+    switch (g_engine)
+    {
+        case ENGINE_INTERPRETER:
+            return run_interpreter(c8, budget);
+        case ENGINE_BLOCK:
+            return run_blocks(c8, budget);
+#ifdef THREADED_DISPATCH
+        case ENGINE_THREADED:
+            return run_threaded(c8, budget);
+#endif
+#ifdef AOT
+        case ENGINE_AOT:
+            return run_aot(c8, budget);
+#endif
+    }
+    return 0;
+}
+
+/*
+ * Execute one frame's worth of instructions with the selected engine: either
+ * `budget` instructions, or fewer if an instruction has to wait for the next
+ * frame. Returns the number of instructions executed.
+ */
+static size_t execute_frame(chip8_t *c8, const size_t budget)
+{
+    c8->end_of_frame = 0;
+    c8->idle_loop = 0;
+    PROFILE_FRAME_END(WAIT_NEXT_FRAME);
+    const size_t count = run_engine(c8, budget);
+    return c8->idle_loop ? skip_idle_loop(c8, count, budget) : count;
+}
+
+/*
+ * Return the state of a random number generator that starts from a seed.
+ */
+uint32_t seed_random(const uint32_t seed)
+{
+    const uint32_t state = (0x9e3779b9u * (seed+1));
+    return state ? state : 1;
+}
 
 static void reset(chip8_t *c8)
 {
     memset(c8, 0, sizeof(*c8));
     c8->program_counter = PROGRAM_START;
     c8->stack_pointer = -1;
+    c8->random_state = seed_random(g_seed);
 
     load_memory(c8->memory);
+#ifdef XO_CHIP
+    reset_audio();
+#endif
+
+#ifdef AOT
+    g_aot_valid = aot_matches_memory(c8);
+#endif
 
 #ifdef DEBUG
     print_memory(c8->memory);
 #endif
 }
 
-static void process_ui_controls(chip8_t *c8, const uint16_t instruction)
+/*
+ * Handle pause and restart requests from the user interface. While the program
+ * is paused, the CPU thread sleeps until the I/O thread signals the next
+ * request.
+ */
+static void process_ui_controls(chip8_t *c8)
 {
     uint8_t in_restart = 0;
     uint8_t in_pause = 0;
 
+    pthread_mutex_lock(&g_input_mutex);
     while (!g_io_done)
     {
         if (g_restart)
         {
             draw_restart_icon();
+            publish_display();
             in_restart ^= 1;
             g_restart = 0;
         }
 
-        if (g_pause)
-        {
-            if (in_pause) continue;
+        if (!g_pause) break;
 
+        if (!in_pause)
+        {
             draw_pause_icon();
-            if ((instruction & 0xf0ff) == 0xf00a)
-            {
-                // If a pause interrupts a wait for a keypress, redo it.
-                c8->program_counter -= 2;
-            }
+            publish_display();
             in_pause = 1;
         }
-        else
-        {
-            if (in_restart)
-            {
-                reset(c8);
-                clear_display();
-                clear_terminal();
-            }
-            else if (in_pause)
-            {
-                draw_pause_icon();
-            }
-            break;
-        }
+        pthread_cond_wait(&g_input_cond, &g_input_mutex);
+    }
+    pthread_mutex_unlock(&g_input_mutex);
+
+    if (g_io_done) return;
+    if (in_restart)
+    {
+        reset(c8);
+        reset_display();
+        clear_terminal();
+    }
+    else if (in_pause)
+    {
+        draw_pause_icon();
     }
 }
 
@@ -621,38 +1420,84 @@ static void run(chip8_t *c8)
 #endif
     while (!g_io_done)
     {
-        // Fetch
-        const uint16_t instruction =
+        // Run one frame's worth of instructions in a single batch, and then
+        // wait for the timer thread to start the next frame.
+        PROFILE_WAIT_BEGIN();
+        wait_for_tick();
+        PROFILE_WAIT_END(g_profile_frame_end);
+
+        execute_frame(c8, __atomic_load_n(&g_ipf, __ATOMIC_RELAXED));
+        publish_display();
+        clear_key_events();
+
+        write_registers_to_terminal(
+            c8,
             (c8->memory[c8->program_counter] << 8) |
-            c8->memory[c8->program_counter+1];
-
-        write_registers_to_terminal(c8, instruction);
-
-        advance_program_counter(c8);
+            c8->memory[c8->program_counter+1]
+        );
 
-        // Decode/Execute
-        (g_execute[(instruction & 0xf000) >> 12])(c8, instruction);
+        process_ui_controls(c8);
+    }
+}
 
-        process_ui_controls(c8, instruction);
+static void run_headless(chip8_t *c8)
+{
+#ifdef DEBUG
+    printf("%s start\n", __func__);
+#endif
+    while (!g_io_done)
+    {
+        end_headless_frame(execute_frame(c8, g_ipf));
     }
 }
 
 void *cpu_fn(__attribute__ ((unused)) void *p)
 {
-    chip8_t c8;
+    if (!g_seed_set && !g_headless)
+    {
+        g_seed = (uint32_t)time(NULL);
+    }
+    static chip8_t c8; // too large for the thread's stack, with its caches
     reset(&c8);
 
-    srand(time(NULL));
+#ifdef THREADED_DISPATCH
+    if (g_engine == ENGINE_THREADED)
+    {
+        init_opcode_classes();
+    }
+#endif
+#ifdef PROFILE
+    profile_reset();
+#endif
+#ifdef AOT
+    if ((g_engine == ENGINE_AOT) && !g_aot_valid)
+    {
+        printf("[WARNING] Program was not translated, using the interpreter\n");
+    }
+#endif
 
-    while (!g_timer_start);
+    if (g_headless)
+    {
+        reset_display();
 
-    clear_display();
+        run_headless(&c8);
+    }
+    else
+    {
+        pthread_barrier_wait(&g_start_barrier);
+
+        reset_display();
 
-    init_terminal();
+        init_terminal();
 
-    run(&c8);
+        run(&c8);
 
-    quit_terminal();
+        quit_terminal();
+    }
+
+#ifdef PROFILE
+    profile_report(c8.memory);
+#endif
 
 #ifdef DEBUG
     printf("%s exit\n", __func__);
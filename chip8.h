@@ -1,19 +1,48 @@
 #ifndef CHIP8_H
 #define CHIP8_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#ifdef XO_CHIP
+#define MEMORY_SIZE 0x10000 // 64KB, addressed with `F000 nnnn`
+#else
 #define MEMORY_SIZE 0x1000  // 4KB (4096 bytes)
+#endif
+#define MAX_BLOCK_SIZE 32   // instructions
+#define MAX_FUSED_SIZE 3    // instructions
 #ifdef COSMAC_VIP
 #define STACK_SIZE 12
 #else
 #define STACK_SIZE 16
 #endif
 
-typedef struct
+struct chip8;
+struct decoded;
+
+typedef void (*execute_fn)(struct chip8*, const struct decoded*);
+typedef size_t (*fused_fn)(struct chip8*, const struct decoded*);
+
+/* An instruction with its handler and operands extracted ahead of time */
+typedef struct decoded
+{
+    execute_fn execute; // NULL if not decoded yet
+    uint16_t instruction;
+    uint16_t nnn;
+    uint8_t x;
+    uint8_t y;
+    uint8_t nn;
+    uint8_t n;
+    fused_fn fused;     // superinstruction that starts here (block engine)
+    uint8_t fused_size; // instructions in it, 0 if none
+} decoded_t;
+
+typedef struct chip8
 {
     /* Memory */
     uint8_t memory[MEMORY_SIZE];
+    decoded_t decode_cache[MEMORY_SIZE]; // indexed by instruction address
+    uint8_t block_size[MEMORY_SIZE];     // 0 if no block starts there yet
 
     /* Registers */
     uint8_t V[16];  // data registers (V0-VF)
@@ -24,10 +53,73 @@ typedef struct
     uint16_t stack[STACK_SIZE];
     int8_t stack_pointer;
 
+    /* Scheduling */
+    uint8_t end_of_frame;   // set when the rest of the frame must be skipped
+    uint16_t idle_loop;     // delay timer loop that ended the frame, 0 if none
+
+    /* Random number generator (`Cxnn`) */
+    uint32_t random_state;  // never 0
+
 } chip8_t;
 
 extern volatile uint8_t g_cpu_done;
+extern volatile uint8_t g_cpu_error;
 extern volatile uint8_t g_in_fx0a;
+extern size_t g_ipf;
+extern uint8_t g_display_wait;
+extern uint32_t g_seed;
+extern uint8_t g_seed_set;
+
+typedef enum
+{
+    ENGINE_INTERPRETER, // decode and execute one instruction at a time
+    ENGINE_BLOCK,       // execute cached blocks of straight-line instructions
+#ifdef THREADED_DISPATCH
+    ENGINE_THREADED,    // dispatch on a table of all opcodes with computed goto
+#endif
+#ifdef AOT
+    ENGINE_AOT,         // run code translated from the program at build time
+#endif
+} engine_t;
+extern engine_t g_engine;
+extern const char *g_engine_names[];
+extern const size_t NUM_ENGINES;
 extern void *cpu_fn(void *p);
+extern uint32_t seed_random(const uint32_t seed);
+
+/*
+ * Return the next random number of a generator (xorshift32). The same seed
+ * always produces the same numbers, on every host and in every engine.
+ */
+static inline uint8_t next_random(uint32_t *state)
+{
+    uint32_t s = *state;
+    s ^= (s << 13);
+    s ^= (s >> 17);
+    s ^= (s << 5);
+    *state = s;
+    return (uint8_t)(s >> 24);
+}
+
+/*
+ * Return the length of the instruction at an address, which is how far a skip
+ * moves past it. On the XO-CHIP, that may be the four byte `F000 nnnn`.
+ */
+static inline uint16_t instruction_length(
+    __attribute__ ((unused)) const uint8_t *memory,
+    __attribute__ ((unused)) const uint16_t address
+)
+{
+#ifdef XO_CHIP
+    if ((memory[address] == 0xf0) && (memory[(address+1) % MEMORY_SIZE] == 0))
+    {
+        return 4;
+    }
+#endif
+    return 2;
+}
+#ifdef PROFILE
+extern const char *opcode_class_name(const uint16_t instruction);
+#endif
 
 #endif // CHIP8_H
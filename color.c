@@ -1,7 +1,8 @@
 /*
  * This file contains the code that supports color customization, including all
- * necessary helpers and the two globals that store the interpreter's color
- * codes.
+ * necessary helpers and the palette that stores the interpreter's color codes.
+ * The background and foreground colors can be customized; the other colors are
+ * only used by XO-CHIP programs that draw to more than one bitplane.
  */
 #include <ctype.h>
 #include <stdint.h>
@@ -10,8 +11,16 @@
 
 #include "color.h"
 
-uint32_t g_background_color = 0xff000000;
-uint32_t g_foreground_color = 0xffffffff;
+uint32_t g_palette[1 << NUM_PLANES] =
+{
+    0xff000000, // background
+    0xffffffff, // foreground
+#ifdef XO_CHIP
+    0xffaaaaaa, 0xff555555, 0xffff0000, 0xff00ff00, 0xff0000ff, 0xffffff00,
+    0xff00ffff, 0xffff00ff, 0xff800000, 0xff008000, 0xff000080, 0xff808000,
+    0xff008080, 0xff800080,
+#endif
+};
 
 static void flush_stdin()
 {
@@ -109,7 +118,7 @@ void enter_color_prompt()
     if ((c == 'y') || (c == 'Y'))
     {
         flush_stdin();
-        change_color("Background", &g_background_color);
-        change_color("Foreground", &g_foreground_color);
+        change_color("Background", &g_palette[0]);
+        change_color("Foreground", &g_palette[1]);
     }
 }
@@ -3,8 +3,10 @@
 
 #include <stdint.h>
 
-extern uint32_t g_background_color;
-extern uint32_t g_foreground_color;
+#include "io.h"
+
+/* Indexed by a pixel's bits in every plane: background, foreground, ... */
+extern uint32_t g_palette[1 << NUM_PLANES];
 
 extern void enter_color_prompt();
 
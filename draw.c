@@ -1,53 +1,110 @@
 /*
  * The functions in this file are called from the CPU thread. They write to the
- * display's framebuffer, and then the timer thread renders the framebuffer to
- * the user. `pthread_cond_wait()` is used to enforce a maximum call frequency
- * to these functions, which is determined by the timer thread.
+ * display, which holds one bit per pixel in 64-bit words, one word per row (two
+ * in the SUPER-CHIP's high resolution mode). XO-CHIP programs draw to several
+ * bitplanes, each packed the same way. At the end of each frame, the CPU thread
+ * publishes the display, and the timer thread renders the latest published
+ * frame to the user.
  */
 
-#include <pthread.h>
 #include <stdint.h>
 #include <string.h>
 
 #include "color.h"
 #include "draw.h"
 #include "io.h"
+#include "latency.h"
 
-pthread_mutex_t g_display_mutex = {0};
-pthread_cond_t g_display_cond = {0};
+display_t g_display = {.width = DISPLAY_WIDTH, .height = DISPLAY_HEIGHT};
 
-static const size_t DISPLAY_WIDTH_MASK = (DISPLAY_WIDTH-1);
-static const size_t DISPLAY_HEIGHT_MASK = (DISPLAY_HEIGHT-1);
+/* Bitplanes that are drawn to, cleared, and scrolled (`Fn01`) */
+static uint8_t g_planes = 0x1;
+#define PLANE_SELECTED(plane) (g_planes & (1 << (plane)))
+
+/*
+ * Finished frames are passed to the timer thread through three buffers: one
+ * that the CPU thread fills next, one that the timer thread renders from, and
+ * the latest finished frame in between. Each thread swaps the middle buffer
+ * with its own, so neither ever waits for the other. The middle buffer's index
+ * is packed together with the range of rows that changed since the timer
+ * thread last took a frame, so that both are swapped at once.
+ */
+#define BUFFER_INDEX(middle) ((middle) & 0x03)
+#define FRESH 0x80 // the middle buffer holds a frame that was not rendered yet
+#define FIRST_ROW(middle) (((middle) >> 8) & 0xff)
+#define LAST_ROW(middle) (((middle) >> 16) & 0xff)
+static display_t g_buffers[3] = {0};
+static uint8_t g_back_buffer = 0;       // CPU thread
+static uint32_t g_middle_buffer = 1;    // shared
+static uint8_t g_front_buffer = 2;      // timer thread
+
+/* Rows changed in the current frame, none if first > last */
+static uint8_t g_first_dirty_row = 0; // the first frame is uploaded in full
+static uint8_t g_last_dirty_row = (MAX_DISPLAY_HEIGHT-1);
+
+static void mark_dirty(const uint8_t row)
+{
+    if (row < g_first_dirty_row) g_first_dirty_row = row;
+    if (row > g_last_dirty_row) g_last_dirty_row = row;
+}
 
 void clear_display()
 {
-    pthread_mutex_lock(&g_display_mutex);
-    pthread_cond_wait(&g_display_cond, &g_display_mutex);
-    for (size_t i = 0; i < DISPLAY_AREA; i++)
+    for (size_t plane = 0; plane < NUM_PLANES; plane++)
     {
-        g_framebuffer[i] = g_background_color;
+        if (!PLANE_SELECTED(plane)) continue;
+        for (size_t row = 0; row < g_display.height; row++)
+        {
+            for (size_t word = 0; word < DISPLAY_WORDS; word++)
+            {
+                if (g_display.rows[plane][row][word]) mark_dirty(row);
+            }
+        }
+        memset(g_display.rows[plane], 0, sizeof(g_display.rows[plane]));
     }
-    pthread_mutex_unlock(&g_display_mutex);
 }
 
-static void draw_pixel(
-    const size_t row, const size_t col, const uint8_t is_set, uint8_t *collision
+/*
+ * XOR one line of a sprite into a row of a bitplane, with the sprite's pixels
+ * in the top bits of `line`. Returns nonzero if a pixel was erased.
+ */
+static uint64_t draw_line(
+    const size_t plane, const size_t row, const size_t col, const uint64_t line
 )
 {
-    if (!is_set) return;
-
-    const size_t offset = (row*DISPLAY_WIDTH + col);
+    if (!line) return 0;
 
-    // XOR
-    if (g_framebuffer[offset] == g_foreground_color)
+    // The line is shifted into place across the words of the row. Pixels past
+    // the right edge are shifted out, which clips them.
+    uint64_t pixels[DISPLAY_WORDS] = {0};
+    const size_t word = (col / 64);
+    const size_t shift = (col % 64);
+    pixels[word] = (line >> shift);
+#if DISPLAY_WORDS > 1
+    if (shift && ((word+1) < (g_display.width / 64)))
     {
-        g_framebuffer[offset] = g_background_color;
-        *collision = 1;
+        pixels[word+1] = (line << (64-shift));
     }
-    else
+#endif
+
+    uint64_t *words = g_display.rows[plane][row];
+    uint64_t collision = 0;
+    for (size_t i = word; i < DISPLAY_WORDS; i++)
     {
-        g_framebuffer[offset] = g_foreground_color;
+        collision |= (words[i] & pixels[i]);
+        words[i] ^= pixels[i];
     }
+    mark_dirty(row);
+    return collision;
+}
+
+/*
+ * Return how many bytes of memory a sprite with the given number of bytes per
+ * plane reads, since each selected plane reads its own.
+ */
+size_t sprite_data_size(const size_t plane_size)
+{
+    return plane_size * __builtin_popcount(g_planes);
 }
 
 uint8_t draw_sprite(
@@ -58,25 +115,232 @@ uint8_t draw_sprite(
 )
 {
     // Implements full sprite wrap
-    row &= DISPLAY_HEIGHT_MASK;
-    col &= DISPLAY_WIDTH_MASK;
+    row &= (g_display.height-1);
+    col &= (g_display.width-1);
 
-    uint8_t collision = 0;
-    pthread_mutex_lock(&g_display_mutex);
-    pthread_cond_wait(&g_display_cond, &g_display_mutex);
-    for (size_t i = 0; i < sprite_height; i++)
+    // Each selected plane has its own sprite data, one after the other
+    uint64_t collision = 0;
+    for (size_t plane = 0; plane < NUM_PLANES; plane++)
     {
-        if ((row+i) > DISPLAY_HEIGHT_MASK) break;
-        uint8_t line = sprite_address[i];
-        for (size_t j = 0; j < 8; j++)
+        if (!PLANE_SELECTED(plane)) continue;
+        for (size_t i = 0; i < sprite_height; i++)
         {
-            if ((col+j) > DISPLAY_WIDTH_MASK) break;
-            draw_pixel(row+i, col+j, (line & 0x80), &collision);
-            line <<= 1;
+            if ((row+i) >= g_display.height) break;
+            const uint64_t line = ((uint64_t)sprite_address[i] << 56);
+            collision |= draw_line(plane, row+i, col, line);
+        }
+        sprite_address += sprite_height;
+    }
+    return (collision != 0);
+}
+
+#ifdef SUPER_CHIP
+/*
+ * Draw a 16x16 sprite (`Dxy0`), which is stored as two bytes per line.
+ */
+uint8_t draw_large_sprite(
+    size_t row,
+    size_t col,
+    const uint8_t *sprite_address
+)
+{
+    row &= (g_display.height-1);
+    col &= (g_display.width-1);
+
+    uint64_t collision = 0;
+    for (size_t plane = 0; plane < NUM_PLANES; plane++)
+    {
+        if (!PLANE_SELECTED(plane)) continue;
+        for (size_t i = 0; (i < 16) && ((row+i) < g_display.height); i++)
+        {
+            const uint64_t line =
+                ((uint64_t)((sprite_address[2*i] << 8) | sprite_address[2*i+1])
+                << 48);
+            collision |= draw_line(plane, row+i, col, line);
+        }
+        sprite_address += 32;
+    }
+    return (collision != 0);
+}
+
+static void mark_all_dirty()
+{
+    g_first_dirty_row = 0;
+    g_last_dirty_row = (g_display.height-1);
+}
+
+/*
+ * Switch between the 64x32 and the 128x64 display (`00FE`/`00FF`). Every plane
+ * of the display is cleared.
+ */
+void set_high_resolution(const uint8_t high)
+{
+    g_display.width = high ? MAX_DISPLAY_WIDTH : DISPLAY_WIDTH;
+    g_display.height = high ? MAX_DISPLAY_HEIGHT : DISPLAY_HEIGHT;
+    memset(g_display.rows, 0, sizeof(g_display.rows));
+    mark_all_dirty();
+}
+
+/*
+ * Scroll the selected planes down by `n` rows (`00Cn`). Whole rows are moved.
+ */
+void scroll_display_down(const size_t n)
+{
+    if (!n) return;
+    const size_t moved = (n < g_display.height) ? (g_display.height-n) : 0;
+    const size_t row_size = sizeof(g_display.rows[0][0]);
+    for (size_t plane = 0; plane < NUM_PLANES; plane++)
+    {
+        if (!PLANE_SELECTED(plane)) continue;
+        uint64_t (*rows)[DISPLAY_WORDS] = g_display.rows[plane];
+        memmove(rows[g_display.height-moved], rows[0], moved*row_size);
+        memset(rows[0], 0, (g_display.height-moved)*row_size);
+    }
+    mark_all_dirty();
+}
+
+/*
+ * Scroll the selected planes by 4 pixels (`00FB`/`00FC`). Each row is shifted
+ * as a whole, carrying pixels from one of its words into the next.
+ */
+void scroll_display_right()
+{
+    const size_t last_word = ((g_display.width / 64)-1);
+    for (size_t plane = 0; plane < NUM_PLANES; plane++)
+    {
+        if (!PLANE_SELECTED(plane)) continue;
+        for (size_t row = 0; row < g_display.height; row++)
+        {
+            uint64_t *words = g_display.rows[plane][row];
+            for (size_t i = last_word; i > 0; i--)
+            {
+                words[i] = ((words[i] >> 4) | (words[i-1] << 60));
+            }
+            words[0] >>= 4;
+        }
+    }
+    mark_all_dirty();
+}
+
+void scroll_display_left()
+{
+    const size_t last_word = ((g_display.width / 64)-1);
+    for (size_t plane = 0; plane < NUM_PLANES; plane++)
+    {
+        if (!PLANE_SELECTED(plane)) continue;
+        for (size_t row = 0; row < g_display.height; row++)
+        {
+            uint64_t *words = g_display.rows[plane][row];
+            for (size_t i = 0; i < last_word; i++)
+            {
+                words[i] = ((words[i] << 4) | (words[i+1] >> 60));
+            }
+            words[last_word] <<= 4;
+        }
+    }
+    mark_all_dirty();
+}
+#endif // SUPER_CHIP
+
+#ifdef XO_CHIP
+/*
+ * Select the bitplanes that later draws, clears, and scrolls apply to (`Fn01`).
+ */
+void select_planes(const uint8_t planes)
+{
+    g_planes = (planes & ((1 << NUM_PLANES)-1));
+}
+#endif
+
+/*
+ * Return the display to its initial state, e.g. when the program is restarted.
+ */
+void reset_display()
+{
+    g_planes = 0x1;
+#ifdef SUPER_CHIP
+    set_high_resolution(0);
+#endif
+    clear_display();
+}
+
+/*
+ * Called from the CPU thread when the display holds a finished frame. A frame
+ * in which nothing changed is not published at all.
+ */
+void publish_display()
+{
+    if (g_first_dirty_row > g_last_dirty_row) return;
+    memcpy(&g_buffers[g_back_buffer], &g_display, sizeof(g_display));
+
+    uint32_t middle = __atomic_load_n(&g_middle_buffer, __ATOMIC_RELAXED);
+    uint32_t next;
+    do
+    {
+        uint8_t first = g_first_dirty_row;
+        uint8_t last = g_last_dirty_row;
+        if (middle & FRESH)
+        {
+            // The timer thread skipped that frame, so its rows are still dirty
+            if (FIRST_ROW(middle) < first) first = FIRST_ROW(middle);
+            if (LAST_ROW(middle) > last) last = LAST_ROW(middle);
+        }
+        next = (g_back_buffer | FRESH | (first << 8) | (last << 16));
+    } while (!__atomic_compare_exchange_n(
+        &g_middle_buffer, &middle, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED
+    ));
+    g_back_buffer = BUFFER_INDEX(middle);
+    LATENCY(latency_publish());
+
+    g_first_dirty_row = 0xff;
+    g_last_dirty_row = 0;
+}
+
+/*
+ * Called from the timer thread. Returns the latest finished frame and the range
+ * of rows that changed since the previous call, or NULL if nothing changed.
+ */
+const display_t *take_display(size_t *first_row, size_t *last_row)
+{
+    if (!(__atomic_load_n(&g_middle_buffer, __ATOMIC_RELAXED) & FRESH))
+    {
+        return NULL;
+    }
+    const uint32_t middle = __atomic_exchange_n(
+        &g_middle_buffer, g_front_buffer, __ATOMIC_ACQ_REL
+    );
+    g_front_buffer = BUFFER_INDEX(middle);
+    *first_row = FIRST_ROW(middle);
+    *last_row = LAST_ROW(middle);
+    return &g_buffers[g_front_buffer];
+}
+
+/*
+ * Convert rows of the display to one ARGB color per pixel, for rendering. A
+ * pixel's color is indexed by its bits in every plane.
+ */
+void expand_display(
+    const display_t *display, uint32_t *framebuffer,
+    const size_t first_row, const size_t last_row
+)
+{
+    for (size_t row = first_row; row <= last_row; row++)
+    {
+        uint32_t *pixels = &framebuffer[row*display->width];
+        for (size_t col = 0; col < display->width; col++)
+        {
+            const size_t word = (col / 64);
+            const size_t shift = (63 - (col % 64));
+            uint8_t color = 0;
+            for (size_t plane = 0; plane < NUM_PLANES; plane++)
+            {
+                const uint64_t bit =
+                    ((display->rows[plane][row][word] >> shift) & 1);
+                color |= (bit << plane);
+            }
+            pixels[col] = g_palette[color];
         }
     }
-    pthread_mutex_unlock(&g_display_mutex);
-    return collision;
 }
 
 static const uint8_t pause_icon[] = {
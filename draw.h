@@ -1,19 +1,40 @@
 #ifndef DRAW_H
 #define DRAW_H
 
-#include <pthread.h>
+#include <stddef.h>
 #include <stdint.h>
 
-extern pthread_mutex_t g_display_mutex;
-extern pthread_cond_t g_display_cond;
+#include "io.h"
 
 extern void clear_display();
+extern void reset_display();
+extern void expand_display(
+    const display_t *display, uint32_t *framebuffer,
+    const size_t first_row, const size_t last_row
+);
+extern size_t sprite_data_size(const size_t plane_size);
 extern uint8_t draw_sprite(
     size_t row,
     size_t col,
     const uint8_t *sprite_address,
     const size_t sprite_size
 );
+#ifdef SUPER_CHIP
+extern uint8_t draw_large_sprite(
+    size_t row,
+    size_t col,
+    const uint8_t *sprite_address
+);
+extern void set_high_resolution(const uint8_t high);
+extern void scroll_display_down(const size_t n);
+extern void scroll_display_right();
+extern void scroll_display_left();
+#endif
+#ifdef XO_CHIP
+extern void select_planes(const uint8_t planes);
+#endif
+extern void publish_display();
+extern const display_t *take_display(size_t *first_row, size_t *last_row);
 extern void draw_pause_icon();
 extern void draw_restart_icon();
 
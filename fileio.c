@@ -0,0 +1,43 @@
+/*
+ * The functions in this file help write the output files (`--record`,
+ * `--record-audio`): writing a whole buffer to a file or a named pipe, and
+ * storing little-endian header fields.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "fileio.h"
+
+/*
+ * Write all `size` bytes, however many calls that takes. Returns 0 on error,
+ * with errno set.
+ */
+int write_all(const int fd, const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t*)data;
+    while (size)
+    {
+        const ssize_t written = write(fd, bytes, size);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return 1;
+}
+
+void put_u16(uint8_t *bytes, const uint16_t value)
+{
+    bytes[0] = (value & 0xff);
+    bytes[1] = (value >> 8);
+}
+
+void put_u32(uint8_t *bytes, const uint32_t value)
+{
+    put_u16(&bytes[0], (value & 0xffff));
+    put_u16(&bytes[2], (value >> 16));
+}
@@ -0,0 +1,11 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern int write_all(const int fd, const void *data, size_t size);
+extern void put_u16(uint8_t *bytes, const uint16_t value);
+extern void put_u32(uint8_t *bytes, const uint32_t value);
+
+#endif // FILEIO_H
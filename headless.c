@@ -0,0 +1,112 @@
+/*
+ * The functions in this file implement headless mode, in which the CPU thread
+ * runs by itself: there is no application window, no sound, and no terminal
+ * output. Instead of being paced by the timer thread, the CPU thread executes a
+ * frame's worth of instructions and then calls `end_headless_frame()`, which
+ * takes over the timer thread's duties of decrementing the system timers
+ * and keeping the frame rate. The frame rate may also be left uncapped, so that
+ * programs run as fast as the host machine allows. Keys are only pressed by an
+ * input script (see script.c), and sound is only rendered to a file (wav.c).
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "chip8.h"
+#include "headless.h"
+#include "io.h"
+#include "keypad.h"
+#include "record.h"
+#include "script.h"
+#include "timer.h"
+#include "wav.h"
+
+uint8_t g_headless = 0;
+size_t g_headless_fps = 60;         // 0 means uncapped
+size_t g_headless_max_frames = 0;   // 0 means no limit
+
+static size_t g_frame_count = 0;
+static size_t g_instruction_count = 0;
+static struct timespec g_start_time = {0};
+
+static long elapsed_ns(const struct timespec *before, const struct timespec *after)
+{
+    return (
+        (after->tv_sec - before->tv_sec) * 1000000000 +
+        (after->tv_nsec - before->tv_nsec)
+    );
+}
+
+void headless_init()
+{
+    // Start from a clean slate, in case of a previous run in this process
+    g_io_done = 0;
+    g_frame_count = 0;
+    g_instruction_count = 0;
+    g_delay_timer = 0;
+    g_sound_timer = 0;
+    reset_keypad();
+    script_frame(0);
+    init_audio();
+
+    clock_gettime(CLOCK_MONOTONIC, &g_start_time);
+}
+
+void end_headless_frame(const size_t instructions)
+{
+    record_frame(&g_display, NULL);
+    wav_frame();
+    decrement_timers();
+    pace_headless_frame(instructions);
+    script_frame(g_frame_count);
+}
+
+/*
+ * Count a finished frame, stop if the frame limit has been reached, and
+ * otherwise wait until it is time to start the next frame.
+ */
+void pace_headless_frame(const size_t instructions)
+{
+    g_instruction_count += instructions;
+    g_frame_count++;
+    if (g_headless_max_frames && (g_frame_count >= g_headless_max_frames))
+    {
+        g_io_done = 1;
+        return;
+    }
+
+    if (g_headless_fps)
+    {
+        // Sleep until the absolute start time of the next frame, so that time
+        // spent oversleeping does not accumulate.
+        const long long offset_ns =
+            (long long)g_frame_count * 1000000000 / g_headless_fps;
+        struct timespec deadline = g_start_time;
+        deadline.tv_sec += (offset_ns / 1000000000);
+        deadline.tv_nsec += (offset_ns % 1000000000);
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    }
+}
+
+void headless_quit()
+{
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    const double seconds = elapsed_ns(&g_start_time, &end_time) / 1e9;
+    printf(
+        "Frames: %zu  Instructions: %zu  Time: %.3f s\n",
+        g_frame_count, g_instruction_count, seconds
+    );
+    if (seconds > 0)
+    {
+        printf(
+            "%.1f frames/s  %.0f instructions/s\n",
+            g_frame_count / seconds, g_instruction_count / seconds
+        );
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern uint8_t g_headless;
+extern size_t g_headless_fps;
+extern size_t g_headless_max_frames;
+
+extern void headless_init();
+extern void end_headless_frame(const size_t instructions);
+extern void pace_headless_frame(const size_t instructions);
+extern void headless_quit();
+
+#endif // HEADLESS_H
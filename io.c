@@ -2,9 +2,9 @@
  * The functions in this file run in the main "I/O" thread. This thread is
  * responsible for handling the user interface, including the application
  * window, the display, and sound. The remainder (and majority) of its time is
- * spent polling for key input from the user. Valid key input events signal the
- * CPU thread, which then processes those events. All of these features are made
- * possible by the SDL development library.
+ * spent asleep, waiting for key input from the user. Valid key input events
+ * signal the CPU thread, which then processes those events. All of these
+ * features are made possible by the SDL development library.
  */
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_audio.h>
@@ -19,6 +19,8 @@
 
 #include "chip8.h"
 #include "io.h"
+#include "keypad.h"
+#include "latency.h"
 #include "timer.h"
 
 volatile uint8_t g_io_done = 0;
@@ -33,12 +35,11 @@ SDL_Texture *g_texture = NULL;
 uint32_t *g_framebuffer = NULL;
 size_t g_buffer_size = 0;
 size_t g_width_in_bytes = 0;
-const size_t DISPLAY_AREA = (DISPLAY_WIDTH*DISPLAY_HEIGHT);
+const size_t DISPLAY_AREA = (MAX_DISPLAY_WIDTH*MAX_DISPLAY_HEIGHT);
+volatile uint8_t g_redraw = 0;
 
 /* Key input */
-uint8_t *g_keystate = NULL;
-uint8_t g_key_released = 0xff;
-const size_t g_keymap[] =
+static const SDL_Scancode g_keymap[NUM_KEYS] =
 {
     // Set (CHIP-8 -> keyboard) key mappings
     SDL_SCANCODE_X,
@@ -61,12 +62,52 @@ const size_t g_keymap[] =
 pthread_mutex_t g_input_mutex = {0};
 pthread_cond_t g_input_cond = {0};
 
-/* Sound */
+/*
+ * Sound
+ *
+ * The audio device plays for as long as the window is open. The audio callback
+ * itself gates the tone on the sound timer, sample by sample, so the timer
+ * thread never calls into SDL's audio subsystem. The tone's volume ramps up and
+ * down over a few milliseconds instead of jumping, which would click.
+ */
 SDL_AudioDeviceID g_audio_device_id = {0};
-static uint64_t g_samples_played = 0;
 static const float SOUND_VOLUME = 0.05;
+static const float SOUND_SAMPLE_RATE = AUDIO_SAMPLE_RATE;
+static const float SOUND_RAMP_STEP = (1.0 / 88); // full volume in ~2ms
+static float g_gain = 0.0;          // rendering only
+#ifdef XO_CHIP
+/*
+ * XO-CHIP programs play a pattern of 128 one-bit samples (`F002`) in a loop, at
+ * a rate set by the pitch (`Fx3A`). Both are written by the CPU thread and read
+ * by the audio callback, one word at a time. The callback steps through the
+ * pattern with a phase accumulator, whose top 7 bits index the pattern.
+ */
+static const uint8_t DEFAULT_PITCH = 64; // 4000 samples per second
+static const uint8_t DEFAULT_PATTERN[16] =
+{
+    0xff, 0x00, 0xff, 0x00, 0xff, 0x00, 0xff, 0x00,
+    0xff, 0x00, 0xff, 0x00, 0xff, 0x00, 0xff, 0x00,
+};
+static uint64_t g_audio_pattern[2];
+static uint32_t g_audio_step;       // phase step per output sample
+static uint32_t g_audio_phase = 0;  // rendering only
+#else
+/*
+ * The tone is read from a table of one period of a sine wave, stepped through
+ * with a phase accumulator, whose top 8 bits index the table.
+ */
+#define WAVETABLE_SIZE 256
 static const float SOUND_FREQUENCY = 300.0;
-static const float SOUND_SAMPLE_RATE = 44100.0;
+static float g_wavetable[WAVETABLE_SIZE];
+static uint32_t g_audio_step;       // phase step per output sample
+static uint32_t g_audio_phase = 0;  // rendering only
+#endif
+
+/* CPU speed */
+static const size_t MAX_IPF = 100000;
+
+/* Longest time that the I/O thread sleeps for an event at once */
+static const int IO_WAIT_MS = 100;
 
 static void handle_sdl_fatal(const char *message)
 {
@@ -78,30 +119,153 @@ static void handle_sdl_fatal(const char *message)
     exit(EXIT_FAILURE);
 }
 
+/*
+ * Render stereo samples (two 32-bit floats each) of the tone, gated by the
+ * sound timer. Called from the audio callback, or in headless mode, where no
+ * audio device is opened, from the CPU thread (see wav.c).
+ */
+void render_audio(float *fstream, const size_t num_samples)
+{
+#ifdef XO_CHIP
+    const uint64_t pattern[2] =
+    {
+        __atomic_load_n(&g_audio_pattern[0], __ATOMIC_RELAXED),
+        __atomic_load_n(&g_audio_pattern[1], __ATOMIC_RELAXED),
+    };
+#endif
+    const uint32_t step = __atomic_load_n(&g_audio_step, __ATOMIC_RELAXED);
+    for(size_t i = 0; i < num_samples; ++i)
+    {
+        // Ramp towards full volume while the sound timer runs, else silence
+        if (__atomic_load_n(&g_sound_timer, __ATOMIC_RELAXED))
+        {
+            g_gain = (g_gain < (1.0 - SOUND_RAMP_STEP)) ?
+                (g_gain + SOUND_RAMP_STEP) : 1.0;
+        }
+        else
+        {
+            g_gain = (g_gain > SOUND_RAMP_STEP) ?
+                (g_gain - SOUND_RAMP_STEP) : 0.0;
+        }
+#ifdef XO_CHIP
+        const uint32_t bit = (g_audio_phase >> 25);
+        const uint8_t is_set = ((pattern[bit / 64] >> (63 - (bit % 64))) & 1);
+        const float wave = is_set ? 1.0 : -1.0;
+#else
+        const float wave = g_wavetable[g_audio_phase >> 24];
+#endif
+        const float sample = (SOUND_VOLUME * g_gain * wave);
+        fstream[2*i + 0] = sample; // L
+        fstream[2*i + 1] = sample; // R
+        g_audio_phase += step;
+    }
+}
+
 static void audio_callback(
     __attribute__ ((unused)) void *user_data,
     uint8_t *stream,
     int num_bytes
 )
 {
-    float *fstream = (float*)stream;
-    size_t num_samples = (num_bytes/8); // each sample is two 32-bit floats
-    for(size_t i = 0; i < num_samples; ++i)
+    render_audio((float*)stream, (num_bytes/8));
+}
+
+#ifdef XO_CHIP
+/*
+ * Called from the CPU thread (`F002`). The pattern is 16 bytes, the first
+ * sample in the top bit of the first byte.
+ */
+void set_audio_pattern(const uint8_t *pattern)
+{
+    for (size_t i = 0; i < 2; i++)
     {
-        const double x =
-            2.0 * M_PI * SOUND_FREQUENCY *
-            (g_samples_played + i) / SOUND_SAMPLE_RATE;
-        fstream[2*i + 0] = SOUND_VOLUME * sin(x); // L
-        fstream[2*i + 1] = SOUND_VOLUME * sin(x); // R
+        uint64_t word = 0;
+        for (size_t j = 0; j < 8; j++)
+        {
+            word = ((word << 8) | pattern[8*i + j]);
+        }
+        __atomic_store_n(&g_audio_pattern[i], word, __ATOMIC_RELAXED);
     }
-    g_samples_played += num_samples;
 }
 
-void io_init()
+/*
+ * Called from the CPU thread (`Fx3A`). The pattern is played at
+ * 4000*2^((pitch-64)/48) samples per second.
+ */
+void set_audio_pitch(const uint8_t pitch)
+{
+    const double rate = 4000.0 * pow(2.0, (pitch - 64) / 48.0);
+    const uint32_t step = (uint32_t)((rate / SOUND_SAMPLE_RATE) * (1 << 25));
+    __atomic_store_n(&g_audio_step, step, __ATOMIC_RELAXED);
+}
+
+void reset_audio()
+{
+    set_audio_pattern(DEFAULT_PATTERN);
+    set_audio_pitch(DEFAULT_PITCH);
+}
+#endif
+
+/*
+ * Start the tone from silence, at the start of its wave.
+ */
+void init_audio()
+{
+#ifndef XO_CHIP
+    for (size_t i = 0; i < WAVETABLE_SIZE; i++)
+    {
+        g_wavetable[i] = sinf(2.0 * M_PI * i / WAVETABLE_SIZE);
+    }
+    g_audio_step =
+        (uint32_t)((SOUND_FREQUENCY / SOUND_SAMPLE_RATE) * 4294967296.0);
+#endif
+    g_audio_phase = 0;
+    g_gain = 0.0;
+}
+
+void init_framebuffer()
 {
     g_buffer_size = DISPLAY_AREA * sizeof(uint32_t);
     g_framebuffer = (uint32_t*)malloc(g_buffer_size);
     g_width_in_bytes = DISPLAY_WIDTH * sizeof(uint32_t);
+}
+
+/*
+ * (Re)create the texture at the display's resolution. Called from the timer
+ * thread when the program switches resolutions; the window keeps its size.
+ */
+void resize_texture(const size_t width, const size_t height)
+{
+    if (g_texture)
+    {
+        SDL_DestroyTexture(g_texture);
+    }
+    g_texture = SDL_CreateTexture(
+        g_renderer,
+        SDL_PIXELFORMAT_ARGB8888 , // fast
+        SDL_TEXTUREACCESS_STREAMING,
+        width,
+        height
+    );
+    if (!g_texture)
+    {
+        handle_sdl_fatal("Unable to create texture");
+    }
+    g_width_in_bytes = width * sizeof(uint32_t);
+}
+
+void free_framebuffer()
+{
+    if (g_framebuffer)
+    {
+        free(g_framebuffer);
+        g_framebuffer = NULL;
+    }
+}
+
+void io_init()
+{
+    init_framebuffer();
 
     if (SDL_Init(SDL_INIT_AUDIO|SDL_INIT_VIDEO) < 0)
     {
@@ -131,20 +295,9 @@ void io_init()
         handle_sdl_fatal("Unable to create renderer");
     }
 
-    g_texture = SDL_CreateTexture(
-        g_renderer,
-        SDL_PIXELFORMAT_ARGB8888 , // fast
-        SDL_TEXTUREACCESS_STREAMING,
-        DISPLAY_WIDTH,
-        DISPLAY_HEIGHT
-    );
-    if (!g_texture)
-    {
-        handle_sdl_fatal("Unable to create texture");
-    }
+    resize_texture(DISPLAY_WIDTH, DISPLAY_HEIGHT);
 
-    g_keystate = (uint8_t*)SDL_GetKeyboardState(NULL);
-    
+    init_audio();
     SDL_AudioSpec audio_spec_want = {0}, audio_spec;
     audio_spec_want.freq     = (int)SOUND_SAMPLE_RATE;
     audio_spec_want.format   = AUDIO_F32;
@@ -162,6 +315,19 @@ void io_init()
     {
         handle_sdl_fatal("Unable to open audio device");
     }
+    SDL_PauseAudioDevice(g_audio_device_id, 0); // the callback gates the tone
+}
+
+/*
+ * Returns the keypad key (0-F) at a physical key, or 0xff if there is none.
+ */
+static uint8_t keypad_key(const SDL_Scancode scancode)
+{
+    for (uint8_t key = 0; key < NUM_KEYS; key++)
+    {
+        if (g_keymap[key] == scancode) return key;
+    }
+    return 0xff;
 }
 
 static void quit()
@@ -174,31 +340,13 @@ static void quit()
 
 void io_loop()
 {
-    // Set (keyboard -> CHIP-8) key mappings
-    const uint8_t keymap[] =
-    {
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0x01, 0x02, 0x03, 0x0c, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0x07, 0xff, 0x0b, 0x09, 0x06, 0x0e, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0x04, 0x0d, 0x08, 0xff, 0xff, 0x0f, 0x05,
-        0x00, 0xff, 0x0a,
-    };
-
     while (1)
     {
+        // Sleep until the next event arrives, rather than polling for it
         SDL_Event e;
-        while (SDL_PollEvent(&e))
+        uint8_t key;
+        if (!SDL_WaitEventTimeout(&e, IO_WAIT_MS)) continue;
+        do
         {
             if (e.type == SDL_KEYUP)
             {
@@ -256,6 +404,28 @@ void io_loop()
                         );
                     }
                     continue;
+                case SDLK_LEFTBRACKET:
+                {
+                    /* Decrease CPU speed */
+                    size_t ipf = __atomic_load_n(&g_ipf, __ATOMIC_RELAXED);
+                    if (ipf > 1)
+                    {
+                        ipf -= (ipf >= 5) ? (ipf / 5) : 1;
+                        __atomic_store_n(&g_ipf, ipf, __ATOMIC_RELAXED);
+                    }
+                    continue;
+                }
+                case SDLK_RIGHTBRACKET:
+                {
+                    /* Increase CPU speed */
+                    size_t ipf = __atomic_load_n(&g_ipf, __ATOMIC_RELAXED);
+                    if (ipf < MAX_IPF)
+                    {
+                        ipf += (ipf >= 4) ? (ipf / 4) : 1;
+                        __atomic_store_n(&g_ipf, ipf, __ATOMIC_RELAXED);
+                    }
+                    continue;
+                }
                 case SDLK_ESCAPE:
                     /* Quit */
                     quit();
@@ -271,40 +441,41 @@ void io_loop()
                 quit();
                 return;
             }
+            else if (e.type == SDL_WINDOWEVENT)
+            {
+                /* Window exposed, resized, etc. */
+                g_redraw = 1;
+            }
 
             if (
                 ((e.type == SDL_KEYDOWN) || (e.type == SDL_KEYUP)) &&
-                (e.key.keysym.sym < (int32_t)sizeof(keymap)) &&
-                (keymap[e.key.keysym.sym] < 16)
+                !e.key.repeat &&
+                ((key = keypad_key(e.key.keysym.scancode)) < NUM_KEYS)
             )
             {
                 /* Keypad */
                 if (g_in_fx0a)
                 {
-                    pthread_mutex_lock(&g_timer_mutex);
-                    g_sound_timer = 0x04;
-                    pthread_mutex_unlock(&g_timer_mutex);
+                    __atomic_store_n(&g_sound_timer, 0x04, __ATOMIC_RELAXED);
                 }
+                LATENCY(latency_event(key));
+                set_key(key, (e.type == SDL_KEYDOWN));
                 if (e.type == SDL_KEYUP)
                 {
+                    // Wake the CPU thread, if it waits in `Fx0A`
                     pthread_mutex_lock(&g_input_mutex);
-                    g_key_released = keymap[e.key.keysym.sym];
                     pthread_cond_signal(&g_input_cond);
                     pthread_mutex_unlock(&g_input_mutex);
                 }
             }
-        }
+        } while (SDL_PollEvent(&e));
     }
 }
 
 void io_quit()
 {
     SDL_CloseAudioDevice(g_audio_device_id);
-    if (g_framebuffer)
-    {
-        free(g_framebuffer);
-        g_framebuffer = NULL;
-    }
+    free_framebuffer();
     if (g_texture)
     {
         SDL_DestroyTexture(g_texture);
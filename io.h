@@ -7,28 +7,58 @@
 
 #define DISPLAY_WIDTH   64
 #define DISPLAY_HEIGHT  32
+#ifdef SUPER_CHIP
+#define MAX_DISPLAY_WIDTH   128 // high resolution mode
+#define MAX_DISPLAY_HEIGHT  64
+#else
+#define MAX_DISPLAY_WIDTH   DISPLAY_WIDTH
+#define MAX_DISPLAY_HEIGHT  DISPLAY_HEIGHT
+#endif
+#define DISPLAY_WORDS   (MAX_DISPLAY_WIDTH/64) // 64-bit words per row
+#ifdef XO_CHIP
+#define NUM_PLANES      4 // each pixel's color is a bit from every plane
+#else
+#define NUM_PLANES      1
+#endif
 
 /* Display */
+typedef struct
+{
+    // Bit 63 of a row's first word is its leftmost pixel
+    uint64_t rows[NUM_PLANES][MAX_DISPLAY_HEIGHT][DISPLAY_WORDS];
+    uint8_t width;  // current resolution
+    uint8_t height;
+} display_t;
+extern display_t g_display;
 extern SDL_Renderer *g_renderer;
 extern SDL_Texture *g_texture;
 extern uint32_t *g_framebuffer;
 extern size_t g_buffer_size;
 extern size_t g_width_in_bytes;
 extern const size_t DISPLAY_AREA;
+extern volatile uint8_t g_redraw; // set when the window must be presented again
 
 /* Key input */
-extern uint8_t *g_keystate;
-extern uint8_t g_key_released;
-extern const size_t g_keymap[];
 extern pthread_mutex_t g_input_mutex;
 extern pthread_cond_t g_input_cond;
 
 /* Sound */
+#define AUDIO_SAMPLE_RATE 44100
 extern SDL_AudioDeviceID g_audio_device_id;
+extern void init_audio();
+extern void render_audio(float *fstream, const size_t num_samples);
+#ifdef XO_CHIP
+extern void reset_audio();
+extern void set_audio_pattern(const uint8_t *pattern);
+extern void set_audio_pitch(const uint8_t pitch);
+#endif
 
 extern volatile uint8_t g_io_done;
 extern volatile uint8_t g_pause;
 extern volatile uint8_t g_restart;
+extern void init_framebuffer();
+extern void resize_texture(const size_t width, const size_t height);
+extern void free_framebuffer();
 extern void io_init();
 extern void io_loop();
 extern void io_quit();
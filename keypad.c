@@ -0,0 +1,79 @@
+/*
+ * The functions in this file hold the state of the 16-key keypad, which belongs
+ * to the interpreter rather than to SDL. Keys are pressed and released by one
+ * thread (the I/O thread, or an input script in headless mode) and read by the
+ * CPU thread, without locks:
+ * - The state of every key is one 16-bit word, updated atomically. `Ex9E` and
+ *   `ExA1` read it with a single load.
+ * - Every change is also queued as an event, for `Fx0A`, which waits for a key
+ *   to be released. The queue has one producer and one consumer. When it is
+ *   full, new events are dropped, but the state of the keys is still updated.
+ */
+#include <stdint.h>
+
+#include "keypad.h"
+
+uint16_t g_keypad = 0;
+
+static key_event_t g_queue[KEY_QUEUE_SIZE];
+static uint32_t g_queue_head = 0;   // next event to read, CPU thread only
+static uint32_t g_queue_tail = 0;   // next event to write, producer only
+
+/*
+ * Release every key and forget every event. Only called while no other thread
+ * uses the keypad.
+ */
+void reset_keypad()
+{
+    __atomic_store_n(&g_keypad, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_queue_head, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_queue_tail, 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * Called from the producer. Press or release a key (0-F).
+ */
+void set_key(const uint8_t key, const uint8_t down)
+{
+    const uint16_t bit = (1 << (key & 0xf));
+    if (down)
+    {
+        __atomic_fetch_or(&g_keypad, bit, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_fetch_and(&g_keypad, (uint16_t)~bit, __ATOMIC_RELAXED);
+    }
+
+    const uint32_t tail = __atomic_load_n(&g_queue_tail, __ATOMIC_RELAXED);
+    const uint32_t head = __atomic_load_n(&g_queue_head, __ATOMIC_ACQUIRE);
+    if ((tail - head) == KEY_QUEUE_SIZE) return; // full
+    g_queue[tail % KEY_QUEUE_SIZE].key = (key & 0xf);
+    g_queue[tail % KEY_QUEUE_SIZE].down = down;
+    __atomic_store_n(&g_queue_tail, (tail+1), __ATOMIC_RELEASE);
+}
+
+/*
+ * Called from the CPU thread. Take the oldest event from the queue. Returns 0
+ * if there is none.
+ */
+int next_key_event(key_event_t *event)
+{
+    const uint32_t head = __atomic_load_n(&g_queue_head, __ATOMIC_RELAXED);
+    const uint32_t tail = __atomic_load_n(&g_queue_tail, __ATOMIC_ACQUIRE);
+    if (head == tail) return 0;
+    *event = g_queue[head % KEY_QUEUE_SIZE];
+    __atomic_store_n(&g_queue_head, (head+1), __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+ * Called from the CPU thread at the end of each frame. Events that `Fx0A` did
+ * not take during the frame are dropped, so that a later `Fx0A` only sees keys
+ * that are released while it waits.
+ */
+void clear_key_events()
+{
+    const uint32_t tail = __atomic_load_n(&g_queue_tail, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&g_queue_head, tail, __ATOMIC_RELEASE);
+}
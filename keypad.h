@@ -0,0 +1,28 @@
+#ifndef KEYPAD_H
+#define KEYPAD_H
+
+#include <stdint.h>
+
+#define NUM_KEYS 16
+#define KEY_QUEUE_SIZE 64 // events for `Fx0A`, a power of 2
+
+/* A change of one key, as queued for `Fx0A` */
+typedef struct
+{
+    uint8_t key;
+    uint8_t down;   // 1 if the key was pressed, 0 if it was released
+} key_event_t;
+
+/* Bit k is set while key k is pressed */
+extern uint16_t g_keypad;
+
+/* Returns nonzero if the key (low nibble of a register) is pressed */
+#define KEY_PRESSED(key) \
+    ((__atomic_load_n(&g_keypad, __ATOMIC_RELAXED) >> ((key) & 0xf)) & 1)
+
+extern void reset_keypad();
+extern void set_key(const uint8_t key, const uint8_t down);
+extern int next_key_event(key_event_t *event);
+extern void clear_key_events();
+
+#endif // KEYPAD_H
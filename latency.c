@@ -0,0 +1,193 @@
+/*
+ * The functions in this file measure input-to-photon latency (`--latency`): how
+ * long it takes for a key event to show up on the screen. One key event at a
+ * time is followed through four stages, each timestamped by the thread that
+ * reaches it:
+ *
+ *     event    The I/O thread receives a key press or release.
+ *     read     The CPU thread first reads that key (`Ex9E`, `ExA1`, `Fx0A`).
+ *     draw     The program next draws a sprite (`Dxyn`).
+ *     present  The timer thread presents the first frame that holds the draw.
+ *
+ * A new event is only followed once the previous one has been presented, or
+ * after a second, if the program never reads the key or never draws. The time
+ * spent in each stage is reported as percentiles at exit.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "latency.h"
+
+#define MAX_SAMPLES 4096 // per stage, the rest are dropped
+#define STALE_NS 1000000000
+
+typedef enum
+{
+    STAGE_IDLE,         // not following an event
+    STAGE_EVENT,
+    STAGE_READ,
+    STAGE_DRAW,
+    STAGE_PUBLISHED,    // the frame with the draw went to the timer thread
+} stage_t;
+
+typedef enum
+{
+    SPAN_READ,      // event to read
+    SPAN_DRAW,      // read to draw
+    SPAN_PRESENT,   // draw to present
+    SPAN_TOTAL,     // event to present
+    NUM_SPANS,
+} span_t;
+
+static const char *SPAN_NAMES[NUM_SPANS] =
+{
+    "Event to read",
+    "Read to draw",
+    "Draw to present",
+    "Event to present",
+};
+
+uint8_t g_latency = 0;
+
+static uint32_t g_stage = STAGE_IDLE;
+static uint8_t g_key = 0;                   // of the event being followed
+static uint64_t g_times[STAGE_PUBLISHED];   // indexed by stage, in ns
+static uint32_t g_samples[NUM_SPANS][MAX_SAMPLES]; // in us
+static size_t g_num_samples = 0;
+static size_t g_num_stale = 0;
+static uint8_t g_taking = 0; // set if the frame being taken holds the draw
+
+static uint64_t now_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((uint64_t)t.tv_sec * 1000000000 + t.tv_nsec);
+}
+
+/*
+ * Move on to the next stage, if the event is still at the given one. Only the
+ * thread that reaches a stage writes its timestamp, before the stage is
+ * published.
+ */
+static int advance(uint32_t from, const stage_t to)
+{
+    if (__atomic_load_n(&g_stage, __ATOMIC_ACQUIRE) != from) return 0;
+    if (to < STAGE_PUBLISHED) g_times[to] = now_ns();
+    return __atomic_compare_exchange_n(
+        &g_stage, &from, to, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED
+    );
+}
+
+/*
+ * Called from the I/O thread for every keypad event.
+ */
+void latency_event(const uint8_t key)
+{
+    uint32_t stage = __atomic_load_n(&g_stage, __ATOMIC_ACQUIRE);
+    if (stage != STAGE_IDLE)
+    {
+        // Give up on an event that never made it to the screen
+        if ((now_ns() - g_times[STAGE_EVENT]) < STALE_NS) return;
+        if (!__atomic_compare_exchange_n(
+            &g_stage, &stage, STAGE_IDLE, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED
+        )) return;
+        g_num_stale++;
+    }
+    g_key = key;
+    advance(STAGE_IDLE, STAGE_EVENT);
+}
+
+/*
+ * Called from the CPU thread whenever the program reads a key.
+ */
+void latency_read(const uint8_t key)
+{
+    if (__atomic_load_n(&g_stage, __ATOMIC_ACQUIRE) != STAGE_EVENT) return;
+    if ((key & 0xf) != g_key) return;
+    advance(STAGE_EVENT, STAGE_READ);
+}
+
+/*
+ * Called from the CPU thread whenever the program draws a sprite. Icons drawn
+ * by the interpreter itself (pause, restart) are not the program's response.
+ */
+void latency_draw()
+{
+    advance(STAGE_READ, STAGE_DRAW);
+}
+
+/*
+ * Called from the CPU thread whenever it hands a frame to the timer thread.
+ */
+void latency_publish()
+{
+    advance(STAGE_DRAW, STAGE_PUBLISHED);
+}
+
+/*
+ * Called from the timer thread before it takes the latest frame. If the draw
+ * has been published by then, that frame holds it.
+ */
+void latency_take()
+{
+    g_taking = (__atomic_load_n(&g_stage, __ATOMIC_ACQUIRE) == STAGE_PUBLISHED);
+}
+
+/*
+ * Called from the timer thread after it presents the frame that it took.
+ */
+void latency_present()
+{
+    uint32_t stage = __atomic_load_n(&g_stage, __ATOMIC_ACQUIRE);
+    if (!g_taking || (stage != STAGE_PUBLISHED)) return;
+    const uint64_t now = now_ns();
+    const uint64_t *t = g_times;
+    const uint64_t spans[NUM_SPANS] =
+    {
+        t[STAGE_READ] - t[STAGE_EVENT],
+        t[STAGE_DRAW] - t[STAGE_READ],
+        now - t[STAGE_DRAW],
+        now - t[STAGE_EVENT],
+    };
+    if (!__atomic_compare_exchange_n(
+        &g_stage, &stage, STAGE_IDLE, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED
+    )) return; // the I/O thread gave up on the event meanwhile
+
+    if (g_num_samples == MAX_SAMPLES) return;
+    for (size_t i = 0; i < NUM_SPANS; i++)
+    {
+        g_samples[i][g_num_samples] = (uint32_t)(spans[i] / 1000);
+    }
+    g_num_samples++;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    const uint32_t sample_a = *(const uint32_t *)a;
+    const uint32_t sample_b = *(const uint32_t *)b;
+    return (sample_a > sample_b) - (sample_a < sample_b);
+}
+
+void latency_report()
+{
+    printf(
+        "Input latency (%zu events, %zu never shown), in us:\n",
+        g_num_samples, g_num_stale
+    );
+    if (!g_num_samples) return;
+    printf("  %-18s %8s %8s %8s %8s\n", "", "p50", "p90", "p99", "max");
+    for (size_t i = 0; i < NUM_SPANS; i++)
+    {
+        uint32_t *samples = g_samples[i];
+        qsort(samples, g_num_samples, sizeof(samples[0]), compare_samples);
+        printf(
+            "  %-18s %8u %8u %8u %8u\n", SPAN_NAMES[i],
+            samples[(g_num_samples-1) * 50 / 100],
+            samples[(g_num_samples-1) * 90 / 100],
+            samples[(g_num_samples-1) * 99 / 100],
+            samples[g_num_samples-1]
+        );
+    }
+}
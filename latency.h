@@ -0,0 +1,23 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+extern uint8_t g_latency;
+
+extern void latency_event(const uint8_t key);
+extern void latency_read(const uint8_t key);
+extern void latency_draw();
+extern void latency_publish();
+extern void latency_take();
+extern void latency_present();
+extern void latency_report();
+
+/* Call a latency_*() function, if latency is measured (`--latency`) */
+#define LATENCY(call) \
+    do \
+    { \
+        if (g_latency) call; \
+    } while (0)
+
+#endif // LATENCY_H
@@ -14,7 +14,6 @@
 
 char *g_romfile = NULL;
 
-const uint16_t PROGRAM_START = 0x200;
 static const unsigned long MAX_PROGRAM_SIZE = (MEMORY_SIZE-PROGRAM_START);
 
 #ifdef COSMAC_VIP
@@ -43,9 +42,35 @@ static const uint8_t g_font[] =
 };
 const size_t FONT_SIZE = (sizeof(g_font)/16);
 
+#ifdef SUPER_CHIP
+/* 8x10 digits for the high resolution display (`Fx30`), after the small font */
+static const uint8_t g_big_font[] =
+{
+    0x3c, 0x7e, 0xe7, 0xc3, 0xc3, 0xc3, 0xc3, 0xe7, 0x7e, 0x3c, // 0
+    0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3c, // 1
+    0x3e, 0x7f, 0xc3, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xff, 0xff, // 2
+    0x3c, 0x7e, 0xc3, 0x03, 0x0e, 0x0e, 0x03, 0xc3, 0x7e, 0x3c, // 3
+    0x06, 0x0e, 0x1e, 0x36, 0x66, 0xc6, 0xff, 0xff, 0x06, 0x06, // 4
+    0xff, 0xff, 0xc0, 0xc0, 0xfc, 0xfe, 0x03, 0xc3, 0x7e, 0x3c, // 5
+    0x3e, 0x7c, 0xc0, 0xc0, 0xfc, 0xfe, 0xc3, 0xc3, 0x7e, 0x3c, // 6
+    0xff, 0xff, 0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+    0x3c, 0x7e, 0xc3, 0xc3, 0x7e, 0x7e, 0xc3, 0xc3, 0x7e, 0x3c, // 8
+    0x3c, 0x7e, 0xc3, 0xc3, 0x7f, 0x3f, 0x03, 0x03, 0x3e, 0x7c, // 9
+    0x3c, 0x7e, 0xc3, 0xc3, 0xff, 0xff, 0xc3, 0xc3, 0xc3, 0xc3, // A
+    0xfc, 0xfe, 0xc3, 0xc3, 0xfe, 0xfe, 0xc3, 0xc3, 0xfe, 0xfc, // B
+    0x3c, 0x7e, 0xc3, 0xc0, 0xc0, 0xc0, 0xc0, 0xc3, 0x7e, 0x3c, // C
+    0xfc, 0xfe, 0xc3, 0xc3, 0xc3, 0xc3, 0xc3, 0xc3, 0xfe, 0xfc, // D
+    0xff, 0xff, 0xc0, 0xc0, 0xfc, 0xfc, 0xc0, 0xc0, 0xff, 0xff, // E
+    0xff, 0xff, 0xc0, 0xc0, 0xfc, 0xfc, 0xc0, 0xc0, 0xc0, 0xc0, // F
+};
+const size_t BIG_FONT_START = (FONT_START + sizeof(g_font));
+const size_t BIG_FONT_SIZE = (sizeof(g_big_font)/16);
+#endif
+
 static void handle_fatal_error(FILE *fp)
 {
     if (fp) fclose(fp);
+    g_cpu_error = 1;
     pthread_exit(NULL);
 }
 
@@ -94,6 +119,9 @@ void load_memory(uint8_t *memory)
 
     // Load font
     memcpy(&memory[FONT_START], g_font, sizeof(g_font));
+#ifdef SUPER_CHIP
+    memcpy(&memory[BIG_FONT_START], g_big_font, sizeof(g_big_font));
+#endif
 }
 
 #ifdef DEBUG
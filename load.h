@@ -3,10 +3,15 @@
 
 #include <stdint.h>
 
+#define PROGRAM_START 0x200
+
 extern char *g_romfile;
-extern const uint16_t PROGRAM_START;
 extern const size_t FONT_START;
 extern const size_t FONT_SIZE;
+#ifdef SUPER_CHIP
+extern const size_t BIG_FONT_START;
+extern const size_t BIG_FONT_SIZE;
+#endif
 
 extern void load_memory(uint8_t *memory);
 
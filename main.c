@@ -1,44 +1,371 @@
-
+#include <getopt.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "batch.h"
 #include "chip8.h"
 #include "color.h"
 #include "draw.h"
+#include "headless.h"
 #include "io.h"
+#include "latency.h"
 #include "load.h"
+#include "profile.h"
+#include "record.h"
+#include "script.h"
 #include "timer.h"
+#include "wav.h"
+
+static const size_t BENCHMARK_FRAMES = 36000; // 10 minutes at 60Hz
+static uint8_t g_benchmark = 0;
+
+static void print_usage(const char *program_name)
+{
+    printf("[USAGE] %s [OPTIONS] ROM\n", program_name);
+    printf(
+        "\n"
+        "Options:\n"
+        "  --headless      Run without a window, sound, or terminal output\n"
+        "  --ipf N         Instructions per frame (default: %zu)\n"
+        "  --fps N         Headless frame rate, 0 for uncapped (default: %zu)\n"
+        "  --frames N      Headless frame limit, 0 for no limit (default: %zu)\n"
+        "  --display-wait on|off\n"
+        "                  Wait for the next frame after each draw or clear\n"
+        "                  (default: %s)\n"
+        "  --engine NAME   Execution engine: ",
+        g_ipf, g_headless_fps, g_headless_max_frames,
+        g_display_wait ? "on" : "off"
+    );
+    for (size_t i = 0; i < NUM_ENGINES; i++)
+    {
+        printf("%s%s", (i ? ", " : ""), g_engine_names[i]);
+    }
+    printf(
+        " (default: %s)\n"
+        "  --benchmark     Run headless and uncapped with each engine in turn\n"
+        "                  (default frame limit: %zu)\n"
+        "  --batch N       Run N instances at once in lockstep (headless)\n"
+        "  --batch-input FILE\n"
+        "                  Press keys as scripted in a file, per instance\n"
+        "                  (batch)\n"
+        "  --record FILE   Write every frame to a file or named pipe\n"
+        "  --record-format argb|1bpp\n"
+        "                  Pixel format of the recording (default: argb)\n"
+        "  --record-audio FILE\n"
+        "                  Write the sound to a WAV file (headless)\n"
+        "  --input FILE    Press keys as scripted in a file (headless)\n"
+        "  --hash-frames LIST\n"
+        "                  Print a hash of the display at the end of each of\n"
+        "                  these frames, e.g. 60,120 (headless)\n"
+        "  --golden FILE   Compare hashes against those in a file (headless)\n"
+        "  --timer-stats   Report the timing of the 60Hz ticks at exit\n"
+        "  --latency       Measure the time from key input to the screen, and\n"
+        "                  report it at exit\n"
+        "  --seed N        Seed of the random number generator (default: 0\n"
+        "                  headless, from the clock otherwise)\n",
+        g_engine_names[g_engine], BENCHMARK_FRAMES
+    );
+#ifdef PROFILE
+    printf("  --profile FILE  Also write the profile to a CSV file\n");
+#endif
+    printf("  --help          Show this message\n");
+}
+
+static int parse_count(const char *arg, size_t *count)
+{
+    char *end = NULL;
+    const unsigned long value = strtoul(arg, &end, 10);
+    if ((*arg == '\0') || (*arg == '-') || (*end != '\0')) return 0;
+    *count = value;
+    return 1;
+}
+
+static int parse_switch(const char *arg, uint8_t *value)
+{
+    if (strcmp(arg, "on") == 0)
+    {
+        *value = 1;
+    }
+    else if (strcmp(arg, "off") == 0)
+    {
+        *value = 0;
+    }
+    else
+    {
+        return 0;
+    }
+    return 1;
+}
+
+static int parse_record_format(const char *arg)
+{
+    if (strcmp(arg, "argb") == 0)
+    {
+        g_record_format = RECORD_ARGB;
+    }
+    else if (strcmp(arg, "1bpp") == 0)
+    {
+        g_record_format = RECORD_1BPP;
+    }
+    else
+    {
+        return 0;
+    }
+    return 1;
+}
+
+static int parse_seed(const char *arg)
+{
+    size_t seed;
+    if (!parse_count(arg, &seed) || (seed > UINT32_MAX)) return 0;
+    g_seed = (uint32_t)seed;
+    g_seed_set = 1;
+    return 1;
+}
+
+static int parse_engine(const char *arg)
+{
+    for (size_t i = 0; i < NUM_ENGINES; i++)
+    {
+        if (strcmp(arg, g_engine_names[i]) == 0)
+        {
+            g_engine = (engine_t)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_args(int argc, char *argv[])
+{
+    enum
+    {
+        OPT_HEADLESS = 256,
+        OPT_IPF,
+        OPT_FPS,
+        OPT_FRAMES,
+        OPT_DISPLAY_WAIT,
+        OPT_ENGINE,
+        OPT_BENCHMARK,
+        OPT_BATCH,
+        OPT_BATCH_INPUT,
+        OPT_RECORD,
+        OPT_RECORD_FORMAT,
+        OPT_RECORD_AUDIO,
+        OPT_INPUT,
+        OPT_HASH_FRAMES,
+        OPT_GOLDEN,
+        OPT_TIMER_STATS,
+        OPT_LATENCY,
+        OPT_SEED,
+        OPT_PROFILE,
+        OPT_HELP,
+    };
+    static const struct option options[] =
+    {
+        {"headless", no_argument, NULL, OPT_HEADLESS},
+        {"ipf", required_argument, NULL, OPT_IPF},
+        {"fps", required_argument, NULL, OPT_FPS},
+        {"frames", required_argument, NULL, OPT_FRAMES},
+        {"display-wait", required_argument, NULL, OPT_DISPLAY_WAIT},
+        {"engine", required_argument, NULL, OPT_ENGINE},
+        {"benchmark", no_argument, NULL, OPT_BENCHMARK},
+        {"batch", required_argument, NULL, OPT_BATCH},
+        {"batch-input", required_argument, NULL, OPT_BATCH_INPUT},
+        {"record", required_argument, NULL, OPT_RECORD},
+        {"record-format", required_argument, NULL, OPT_RECORD_FORMAT},
+        {"record-audio", required_argument, NULL, OPT_RECORD_AUDIO},
+        {"input", required_argument, NULL, OPT_INPUT},
+        {"hash-frames", required_argument, NULL, OPT_HASH_FRAMES},
+        {"golden", required_argument, NULL, OPT_GOLDEN},
+        {"timer-stats", no_argument, NULL, OPT_TIMER_STATS},
+        {"latency", no_argument, NULL, OPT_LATENCY},
+        {"seed", required_argument, NULL, OPT_SEED},
+#ifdef PROFILE
+        {"profile", required_argument, NULL, OPT_PROFILE},
+#endif
+        {"help", no_argument, NULL, OPT_HELP},
+        {0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case OPT_HEADLESS:
+                g_headless = 1;
+                break;
+            case OPT_IPF:
+                if (!parse_count(optarg, &g_ipf) || (g_ipf == 0)) return 0;
+                break;
+            case OPT_FPS:
+                if (!parse_count(optarg, &g_headless_fps)) return 0;
+                break;
+            case OPT_FRAMES:
+                if (!parse_count(optarg, &g_headless_max_frames)) return 0;
+                break;
+            case OPT_DISPLAY_WAIT:
+                if (!parse_switch(optarg, &g_display_wait)) return 0;
+                break;
+            case OPT_ENGINE:
+                if (!parse_engine(optarg)) return 0;
+                break;
+            case OPT_BENCHMARK:
+                g_benchmark = 1;
+                break;
+            case OPT_BATCH:
+                if (!parse_count(optarg, &g_batch_size) || !g_batch_size)
+                {
+                    return 0;
+                }
+                g_headless = 1;
+                break;
+            case OPT_BATCH_INPUT:
+                g_batch_input_file = optarg;
+                break;
+            case OPT_RECORD:
+                g_record_file = optarg;
+                break;
+            case OPT_RECORD_FORMAT:
+                if (!parse_record_format(optarg)) return 0;
+                break;
+            case OPT_RECORD_AUDIO:
+                g_wav_file = optarg;
+                g_headless = 1;
+                break;
+            case OPT_INPUT:
+                g_input_file = optarg;
+                g_headless = 1;
+                break;
+            case OPT_HASH_FRAMES:
+                g_hash_frames = optarg;
+                g_headless = 1;
+                break;
+            case OPT_GOLDEN:
+                g_golden_file = optarg;
+                g_headless = 1;
+                break;
+            case OPT_TIMER_STATS:
+                g_timer_stats = 1;
+                break;
+            case OPT_LATENCY:
+                g_latency = 1;
+                break;
+            case OPT_SEED:
+                if (!parse_seed(optarg)) return 0;
+                break;
+#ifdef PROFILE
+            case OPT_PROFILE:
+                g_profile_file = optarg;
+                break;
+#endif
+            default:
+                return 0;
+        }
+    }
+
+    if (optind != (argc-1)) return 0;
+    g_romfile = argv[optind];
+
+    // Batch mode has its own input script and report, and no single display
+    if (g_batch_size && (
+        g_input_file || g_hash_frames || g_golden_file || g_record_file ||
+        g_wav_file
+    ))
+    {
+        printf(
+            "[ERROR] --batch does not support --input, --hash-frames, "
+            "--golden, --record, or --record-audio\n"
+        );
+        return 0;
+    }
+    if (g_batch_input_file && !g_batch_size)
+    {
+        printf("[ERROR] --batch-input requires --batch\n");
+        return 0;
+    }
+    return 1;
+}
+
+static void run_headless()
+{
+    pthread_t t;
+    headless_init();
+    pthread_create(&t, NULL, g_batch_size ? batch_fn : cpu_fn, NULL);
+    pthread_join(t, NULL);
+    headless_quit();
+}
+
+/*
+ * Run the same program headless and uncapped with every execution engine, and
+ * report the speed of each one.
+ */
+static void run_benchmark()
+{
+    g_headless = 1;
+    g_headless_fps = 0;
+    if (!g_headless_max_frames)
+    {
+        g_headless_max_frames = BENCHMARK_FRAMES;
+    }
+    for (size_t i = 0; (i < NUM_ENGINES) && !g_cpu_error; i++)
+    {
+        g_engine = (engine_t)i;
+        printf("\nEngine: %s\n", g_engine_names[g_engine]);
+        run_headless();
+    }
+}
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    if (!parse_args(argc, argv))
     {
-        printf("[USAGE] %s ROM\n", argv[0]);
+        print_usage(argv[0]);
         return 1;
     }
-    else
+
+    if (!script_init() || !record_init() || !wav_init())
     {
-        g_romfile = argv[1];
+        return 1;
     }
 
     pthread_t t1, t2;
-    enter_color_prompt();
-    io_init();
-    pthread_mutex_init(&g_display_mutex, NULL);
     pthread_mutex_init(&g_input_mutex, NULL);
-    pthread_mutex_init(&g_timer_mutex, NULL);
-    pthread_cond_init(&g_display_cond, NULL);
+    pthread_mutex_init(&g_tick_mutex, NULL);
     pthread_cond_init(&g_input_cond, NULL);
-    pthread_create(&t1, NULL, timer_fn, NULL);
-    pthread_create(&t2, NULL, cpu_fn, NULL);
-    io_loop();
-    pthread_join(t1, NULL);
-    pthread_join(t2, NULL);
-    pthread_cond_destroy(&g_display_cond);
+    pthread_cond_init(&g_tick_cond, NULL);
+    if (g_benchmark)
+    {
+        run_benchmark();
+    }
+    else if (g_headless)
+    {
+        run_headless();
+    }
+    else
+    {
+        enter_color_prompt();
+        io_init();
+        pthread_barrier_init(&g_start_barrier, NULL, 2);
+        pthread_create(&t1, NULL, timer_fn, NULL);
+        pthread_create(&t2, NULL, cpu_fn, NULL);
+        io_loop();
+        pthread_join(t1, NULL);
+        pthread_join(t2, NULL);
+        pthread_barrier_destroy(&g_start_barrier);
+        io_quit();
+        if (g_timer_stats) timer_report();
+        if (g_latency) latency_report();
+    }
     pthread_cond_destroy(&g_input_cond);
-    pthread_mutex_destroy(&g_display_mutex);
+    pthread_cond_destroy(&g_tick_cond);
     pthread_mutex_destroy(&g_input_mutex);
-    pthread_mutex_destroy(&g_timer_mutex);
-    io_quit();
-    return 0;
+    pthread_mutex_destroy(&g_tick_mutex);
+    record_quit();
+    wav_quit();
+    const size_t mismatches = script_quit();
+    return (g_cpu_error || mismatches) ? 1 : 0;
 }
@@ -0,0 +1,202 @@
+/*
+ * The functions in this file implement the execution profiler, which is only
+ * built with `-DPROFILE=ON`. The engines count every instruction that they
+ * execute, both by address and by instruction, and the time that the CPU
+ * thread spends blocked in a few places is measured. The wait for the next
+ * frame is counted against what ended the frame: a draw, a clear, or anything
+ * else. When the CPU thread exits, a hotspot report is printed, and all of the
+ * counters can also be written to a CSV file (`--profile FILE`).
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8.h"
+#include "profile.h"
+
+#ifdef PROFILE
+
+static const size_t REPORT_LINES = 20;
+
+char *g_profile_file = NULL;
+uint64_t g_profile_addresses[MEMORY_SIZE];
+uint64_t g_profile_instructions[0x10000];
+wait_t g_profile_frame_end = WAIT_NEXT_FRAME;
+
+static uint64_t g_wait_count[NUM_WAITS];
+static uint64_t g_wait_ns[NUM_WAITS];
+static const char *g_wait_names[NUM_WAITS] =
+{
+    "draw_sprite",
+    "clear_display",
+    "next_frame",
+    "fx0a",
+};
+
+/* Executions of every opcode class, gathered for the report */
+typedef struct
+{
+    const char *name;
+    uint64_t count;
+} class_count_t;
+
+uint64_t profile_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+void profile_wait(const wait_t wait, const uint64_t start)
+{
+    g_wait_count[wait]++;
+    g_wait_ns[wait] += (profile_now() - start);
+}
+
+void profile_reset()
+{
+    memset(g_profile_addresses, 0, sizeof(g_profile_addresses));
+    memset(g_profile_instructions, 0, sizeof(g_profile_instructions));
+    memset(g_wait_count, 0, sizeof(g_wait_count));
+    memset(g_wait_ns, 0, sizeof(g_wait_ns));
+}
+
+static int compare_addresses(const void *a, const void *b)
+{
+    const uint64_t count_a = g_profile_addresses[*(const uint16_t *)a];
+    const uint64_t count_b = g_profile_addresses[*(const uint16_t *)b];
+    return (count_a < count_b) - (count_a > count_b);
+}
+
+static int compare_classes(const void *a, const void *b)
+{
+    const uint64_t count_a = ((const class_count_t *)a)->count;
+    const uint64_t count_b = ((const class_count_t *)b)->count;
+    return (count_a < count_b) - (count_a > count_b);
+}
+
+/*
+ * Add up the instruction counts by opcode class. Returns the number of classes
+ * that were executed.
+ */
+static size_t count_classes(class_count_t *classes, const size_t max_classes)
+{
+    size_t num_classes = 0;
+    for (size_t instruction = 0; instruction < 0x10000; instruction++)
+    {
+        const uint64_t count = g_profile_instructions[instruction];
+        if (!count) continue;
+        const char *name = opcode_class_name(instruction);
+        size_t i = 0;
+        while ((i < num_classes) && (classes[i].name != name)) i++;
+        if (i == num_classes)
+        {
+            if (num_classes == max_classes) continue;
+            classes[num_classes].name = name;
+            classes[num_classes].count = 0;
+            num_classes++;
+        }
+        classes[i].count += count;
+    }
+    qsort(classes, num_classes, sizeof(classes[0]), compare_classes);
+    return num_classes;
+}
+
+static void write_csv(const class_count_t *classes, const size_t num_classes)
+{
+    FILE *fp = fopen(g_profile_file, "w");
+    if (!fp)
+    {
+        printf("[ERROR] Unable to open %s for writing\n", g_profile_file);
+        return;
+    }
+    fprintf(fp, "kind,name,count,ns\n");
+    for (size_t address = 0; address < MEMORY_SIZE; address++)
+    {
+        if (!g_profile_addresses[address]) continue;
+        fprintf(
+            fp, "address,0x%03zx,%llu,\n",
+            address, (unsigned long long)g_profile_addresses[address]
+        );
+    }
+    for (size_t i = 0; i < num_classes; i++)
+    {
+        fprintf(
+            fp, "class,%s,%llu,\n",
+            classes[i].name, (unsigned long long)classes[i].count
+        );
+    }
+    for (size_t i = 0; i < NUM_WAITS; i++)
+    {
+        fprintf(
+            fp, "wait,%s,%llu,%llu\n", g_wait_names[i],
+            (unsigned long long)g_wait_count[i],
+            (unsigned long long)g_wait_ns[i]
+        );
+    }
+    fclose(fp);
+    printf("Profile written to %s\n", g_profile_file);
+}
+
+void profile_report(const uint8_t *memory)
+{
+    uint64_t total = 0;
+    for (size_t address = 0; address < MEMORY_SIZE; address++)
+    {
+        total += g_profile_addresses[address];
+    }
+    const double percent = total ? (100.0 / total) : 0.0;
+    printf("\nProfile: %llu instructions\n", (unsigned long long)total);
+
+    // Hottest addresses
+    static uint16_t addresses[MEMORY_SIZE];
+    for (size_t address = 0; address < MEMORY_SIZE; address++)
+    {
+        addresses[address] = address;
+    }
+    qsort(addresses, MEMORY_SIZE, sizeof(addresses[0]), compare_addresses);
+    printf("\n  Address  Instruction  Count                 %%\n");
+    for (size_t i = 0; i < REPORT_LINES; i++)
+    {
+        const uint16_t address = addresses[i];
+        const uint64_t count = g_profile_addresses[address];
+        if (!count) break;
+        printf(
+            "  0x%03x    %02x%02x         %-20llu %6.2f\n", address,
+            memory[address], memory[(address+1) % MEMORY_SIZE],
+            (unsigned long long)count, count*percent
+        );
+    }
+
+    // Opcode classes
+    class_count_t classes[64];
+    const size_t num_classes = count_classes(
+        classes, sizeof(classes)/sizeof(classes[0])
+    );
+    printf("\n  Class                  Count                 %%\n");
+    for (size_t i = 0; i < num_classes; i++)
+    {
+        printf(
+            "  %-22s %-20llu %6.2f\n", classes[i].name,
+            (unsigned long long)classes[i].count, classes[i].count*percent
+        );
+    }
+
+    // Time spent blocked
+    printf("\n  Blocked in             Calls                ms\n");
+    for (size_t i = 0; i < NUM_WAITS; i++)
+    {
+        printf(
+            "  %-22s %-20llu %.3f\n", g_wait_names[i],
+            (unsigned long long)g_wait_count[i], g_wait_ns[i] / 1e6
+        );
+    }
+
+    if (g_profile_file)
+    {
+        write_csv(classes, num_classes);
+    }
+}
+#endif // PROFILE
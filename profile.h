@@ -0,0 +1,73 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+/* Time spent blocked in these is measured separately */
+typedef enum
+{
+    WAIT_DRAW_SPRITE,   // for the next frame, after a frame ended by a draw
+    WAIT_CLEAR_DISPLAY, // for the next frame, after a frame ended by a clear
+    WAIT_NEXT_FRAME,    // for the next frame, after any other frame
+    WAIT_FX0A,
+    NUM_WAITS,
+} wait_t;
+
+#ifdef PROFILE
+
+extern char *g_profile_file;
+extern uint64_t g_profile_addresses[MEMORY_SIZE];
+extern uint64_t g_profile_instructions[0x10000];
+extern wait_t g_profile_frame_end;
+
+extern uint64_t profile_now();
+extern void profile_wait(const wait_t wait, const uint64_t start);
+extern void profile_reset();
+extern void profile_report(const uint8_t *memory);
+
+/* Count one execution of the instruction at the given address */
+#define PROFILE_INSTRUCTION(address, instruction) \
+    do \
+    { \
+        g_profile_addresses[(address)]++; \
+        g_profile_instructions[(instruction)]++; \
+    } while (0)
+
+/* Count `count` executions of the instruction at the given address */
+#define PROFILE_INSTRUCTIONS(address, instruction, count) \
+    do \
+    { \
+        g_profile_addresses[(address)] += (count); \
+        g_profile_instructions[(instruction)] += (count); \
+    } while (0)
+
+/* Count the first `count` instructions that follow a decode cache entry */
+#define PROFILE_DECODED(c8, d, count) \
+    for (size_t profile_i = 0; profile_i < (count); profile_i++) \
+    { \
+        PROFILE_INSTRUCTION( \
+            ((d) - (c8)->decode_cache) + 2*profile_i, \
+            (d)[2*profile_i].instruction \
+        ); \
+    }
+
+#define PROFILE_WAIT_BEGIN() const uint64_t profile_wait_start = profile_now()
+#define PROFILE_WAIT_END(wait) profile_wait((wait), profile_wait_start)
+
+/* Note what ended the frame, for the wait for the next one */
+#define PROFILE_FRAME_END(wait) (g_profile_frame_end = (wait))
+
+#else
+
+#define PROFILE_INSTRUCTION(address, instruction)
+#define PROFILE_INSTRUCTIONS(address, instruction, count)
+#define PROFILE_DECODED(c8, d, count)
+#define PROFILE_WAIT_BEGIN()
+#define PROFILE_WAIT_END(wait)
+#define PROFILE_FRAME_END(wait)
+
+#endif // PROFILE
+
+#endif // PROFILE_H
@@ -0,0 +1,194 @@
+/*
+ * The functions in this file record the display to a file or a named pipe
+ * (`--record FILE`), one frame per 60Hz tick, so that a session can be encoded
+ * offline, e.g. by ffmpeg. In headless mode, frames are recorded as fast as the
+ * CPU thread runs them. The recording starts with a 16-byte header:
+ *
+ *     0   "CH8V"
+ *     4   version (1), format (0: ARGB, 1: 1bpp), planes, 0
+ *     8   width, height, frames per second, 0 (16-bit, little-endian)
+ *
+ * It is followed by frames of a fixed size, at the largest resolution of the
+ * build. ARGB frames hold a 32-bit color per pixel. 1bpp frames hold the rows
+ * of each plane in turn, each row as 64-bit words with the leftmost pixel in
+ * the top bit of the first word. Both are in the host's byte order.
+ *
+ * Frames at that resolution are written straight from the buffer that already
+ * holds them. Only the low resolution frames of SUPER-CHIP builds are scaled
+ * up first, into buffers that are allocated once.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "draw.h"
+#include "fileio.h"
+#include "io.h"
+#include "record.h"
+
+char *g_record_file = NULL;
+record_format_t g_record_format = RECORD_ARGB;
+
+static const uint16_t RECORD_VERSION = 1;
+static const uint16_t RECORD_FPS = 60;
+static int g_record_fd = -1;        // -1 if not recording
+static uint32_t *g_pixels = NULL;   // ARGB frames that are expanded or scaled
+#ifdef SUPER_CHIP
+static display_t g_scaled = {0};    // 1bpp frames that are scaled
+#endif
+
+/*
+ * Open the recording, if one was requested. Opening a named pipe waits for its
+ * reader. Returns 0 on error.
+ */
+int record_init()
+{
+    if (!g_record_file) return 1;
+
+    g_record_fd = open(g_record_file, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (g_record_fd < 0)
+    {
+        printf("[ERROR] Unable to open %s for writing\n", g_record_file);
+        return 0;
+    }
+    signal(SIGPIPE, SIG_IGN); // a reader that goes away only ends the recording
+
+    // The first half holds scaled frames, the second half expanded ones
+    g_pixels = (uint32_t*)malloc(2 * DISPLAY_AREA * sizeof(uint32_t));
+
+    uint8_t header[16] = {'C', 'H', '8', 'V'};
+    header[4] = RECORD_VERSION;
+    header[5] = g_record_format;
+    header[6] = NUM_PLANES;
+    put_u16(&header[8], MAX_DISPLAY_WIDTH);
+    put_u16(&header[10], MAX_DISPLAY_HEIGHT);
+    put_u16(&header[12], RECORD_FPS);
+    if (!g_pixels || !write_all(g_record_fd, header, sizeof(header)))
+    {
+        printf("[ERROR] Unable to start recording to %s\n", g_record_file);
+        record_quit();
+        return 0;
+    }
+    return 1;
+}
+
+#ifdef SUPER_CHIP
+/*
+ * Low resolution frames are scaled up by 2 in both directions.
+ */
+static const uint32_t *scale_pixels(
+    const uint32_t *pixels, const size_t width, const size_t height
+)
+{
+    for (size_t row = 0; row < height; row++)
+    {
+        for (size_t col = 0; col < width; col++)
+        {
+            const uint32_t color = pixels[row*width + col];
+            uint32_t *scaled = &g_pixels[(2*row)*MAX_DISPLAY_WIDTH + (2*col)];
+            scaled[0] = color;
+            scaled[1] = color;
+            scaled[MAX_DISPLAY_WIDTH] = color;
+            scaled[MAX_DISPLAY_WIDTH+1] = color;
+        }
+    }
+    return g_pixels;
+}
+
+/*
+ * Spread 32 pixels out to 64, each one doubled.
+ */
+static uint64_t double_bits(const uint32_t bits)
+{
+    uint64_t x = bits;
+    x = ((x | (x << 16)) & 0x0000ffff0000ffffULL);
+    x = ((x | (x << 8)) & 0x00ff00ff00ff00ffULL);
+    x = ((x | (x << 4)) & 0x0f0f0f0f0f0f0f0fULL);
+    x = ((x | (x << 2)) & 0x3333333333333333ULL);
+    x = ((x | (x << 1)) & 0x5555555555555555ULL);
+    return (x | (x << 1));
+}
+
+static const display_t *scale_bits(const display_t *display)
+{
+    for (size_t plane = 0; plane < NUM_PLANES; plane++)
+    {
+        for (size_t row = 0; row < display->height; row++)
+        {
+            const uint64_t line = display->rows[plane][row][0];
+            for (size_t i = 0; i < 2; i++)
+            {
+                uint64_t *scaled = g_scaled.rows[plane][2*row + i];
+                scaled[0] = double_bits(line >> 32);
+                scaled[1] = double_bits(line & 0xffffffff);
+            }
+        }
+    }
+    return &g_scaled;
+}
+#endif
+
+/*
+ * Write one frame of the display. `framebuffer` may hold the frame already
+ * expanded to ARGB, at the display's resolution, or be NULL.
+ */
+void record_frame(const display_t *display, const uint32_t *framebuffer)
+{
+    if (g_record_fd < 0) return;
+
+    int written;
+    if (g_record_format == RECORD_ARGB)
+    {
+        if (!framebuffer)
+        {
+            uint32_t *expanded = &g_pixels[DISPLAY_AREA];
+            expand_display(display, expanded, 0, display->height-1);
+            framebuffer = expanded;
+        }
+#ifdef SUPER_CHIP
+        if (display->width != MAX_DISPLAY_WIDTH)
+        {
+            framebuffer =
+                scale_pixels(framebuffer, display->width, display->height);
+        }
+#endif
+        written = write_all(
+            g_record_fd, framebuffer, DISPLAY_AREA*sizeof(uint32_t)
+        );
+    }
+    else
+    {
+#ifdef SUPER_CHIP
+        if (display->width != MAX_DISPLAY_WIDTH)
+        {
+            display = scale_bits(display);
+        }
+#endif
+        written = write_all(g_record_fd, display->rows, sizeof(display->rows));
+    }
+
+    if (!written)
+    {
+        printf("[WARNING] Recording stopped (%s)\n", strerror(errno));
+        record_quit();
+    }
+}
+
+void record_quit()
+{
+    if (g_record_fd >= 0)
+    {
+        close(g_record_fd);
+        g_record_fd = -1;
+    }
+    if (g_pixels)
+    {
+        free(g_pixels);
+        g_pixels = NULL;
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+
+#include "io.h"
+
+typedef enum
+{
+    RECORD_ARGB,    // one 32-bit ARGB color per pixel
+    RECORD_1BPP,    // one bit per pixel per plane, as stored in the display
+} record_format_t;
+
+extern char *g_record_file;
+extern record_format_t g_record_format;
+
+extern int record_init();
+extern void record_frame(const display_t *display, const uint32_t *framebuffer);
+extern void record_quit();
+
+#endif // RECORD_H
@@ -0,0 +1,305 @@
+/*
+ * The functions in this file drive scripted headless runs, which make it
+ * possible to check that a program still behaves the same after the
+ * interpreter changes:
+ * - An input script (`--input FILE`) presses and releases keys at the start
+ *   of given frames. Each line holds a frame number (from 1), a key (0-F), and
+ *   "down" or "up". In batch mode (`--batch-input FILE`), each line starts
+ *   with the instance (from 0) whose key it is instead.
+ * - The display is hashed at the end of given frames (`--hash-frames LIST`),
+ *   and each hash is printed as a line "hash FRAME VALUE".
+ * - Those lines can be kept as golden values (`--golden FILE`). The display is
+ *   then hashed at the same frames, and any difference is reported.
+ * Blank lines and lines that start with '#' are ignored in both files.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "io.h"
+#include "keypad.h"
+#include "script.h"
+
+#define MAX_EVENTS 4096
+#define MAX_HASHES 1024
+
+char *g_input_file = NULL;
+char *g_batch_input_file = NULL;
+char *g_hash_frames = NULL;
+char *g_golden_file = NULL;
+
+typedef struct
+{
+    size_t frame;   // at the end of which the display is hashed
+    uint64_t expected;
+    uint8_t has_expected;
+    uint8_t done;
+} hash_t;
+
+static input_event_t g_events[MAX_EVENTS];
+static size_t g_num_events = 0;
+static size_t g_next_event = 0;
+static hash_t g_hashes[MAX_HASHES];
+static size_t g_num_hashes = 0;
+static size_t g_mismatches = 0;
+
+static int is_blank(const char *line)
+{
+    while ((*line == ' ') || (*line == '\t')) line++;
+    return (*line == '\0') || (*line == '\n') || (*line == '#');
+}
+
+/*
+ * Add a frame to hash, unless it is already there. Returns NULL if there are
+ * too many.
+ */
+static hash_t *add_hash(const size_t frame)
+{
+    for (size_t i = 0; i < g_num_hashes; i++)
+    {
+        if (g_hashes[i].frame == frame) return &g_hashes[i];
+    }
+    if (g_num_hashes == MAX_HASHES) return NULL;
+    hash_t *hash = &g_hashes[g_num_hashes++];
+    memset(hash, 0, sizeof(*hash));
+    hash->frame = frame;
+    return hash;
+}
+
+/*
+ * Read the lines of an input script, which start with an instance number in
+ * batch mode.
+ */
+static int read_events(FILE *fp, const char *filename, const uint8_t batch)
+{
+    char line[128];
+    size_t line_number = 0;
+    while (fgets(line, sizeof(line), fp))
+    {
+        line_number++;
+        if (is_blank(line)) continue;
+
+        unsigned long instance = 0;
+        unsigned long frame;
+        unsigned key;
+        char action[8];
+        const int fields = batch ?
+            sscanf(line, "%lu %lu %x %7s", &instance, &frame, &key, action) :
+            (1 + sscanf(line, "%lu %x %7s", &frame, &key, action));
+        if (
+            (fields != 4) || (instance >= (batch ? g_batch_size : 1)) ||
+            (frame == 0) || (key > 0xf) ||
+            (strcmp(action, "down") && strcmp(action, "up"))
+        )
+        {
+            printf("[ERROR] %s:%zu: Invalid input\n", filename, line_number);
+            return 0;
+        }
+        if (g_num_events == MAX_EVENTS)
+        {
+            printf("[ERROR] More than %d inputs\n", MAX_EVENTS);
+            return 0;
+        }
+        // Keep the events in frame order, and in file order within a frame
+        // (e.g. a key that goes down and up in the same frame)
+        size_t i = g_num_events++;
+        while ((i > 0) && (g_events[i-1].frame > frame))
+        {
+            g_events[i] = g_events[i-1];
+            i--;
+        }
+        input_event_t *event = &g_events[i];
+        event->instance = instance;
+        event->frame = frame;
+        event->key = key;
+        event->down = (strcmp(action, "down") == 0);
+    }
+    return 1;
+}
+
+static int read_input(FILE *fp)
+{
+    return read_events(fp, g_input_file, 0);
+}
+
+static int read_batch_input(FILE *fp)
+{
+    return read_events(fp, g_batch_input_file, 1);
+}
+
+static int read_golden(FILE *fp)
+{
+    char line[128];
+    size_t line_number = 0;
+    while (fgets(line, sizeof(line), fp))
+    {
+        line_number++;
+        if (is_blank(line)) continue;
+
+        unsigned long frame;
+        unsigned long long value;
+        hash_t *hash = NULL;
+        if (
+            (sscanf(line, "hash %lu %llx", &frame, &value) != 2) ||
+            (frame == 0) || !(hash = add_hash(frame))
+        )
+        {
+            printf(
+                "[ERROR] %s:%zu: Invalid hash\n", g_golden_file, line_number
+            );
+            return 0;
+        }
+        hash->expected = value;
+        hash->has_expected = 1;
+    }
+    return 1;
+}
+
+static int read_hash_frames(const char *list)
+{
+    while (*list)
+    {
+        char *end = NULL;
+        const unsigned long frame = strtoul(list, &end, 10);
+        if ((end == list) || (frame == 0) || ((*end != ',') && (*end != '\0')))
+        {
+            return 0;
+        }
+        if (!add_hash(frame)) return 0;
+        list = (*end == ',') ? (end+1) : end;
+    }
+    return 1;
+}
+
+static int read_file(const char *filename, int (*read_fn)(FILE*))
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+    {
+        printf("[ERROR] Unable to open %s\n", filename);
+        return 0;
+    }
+    const int result = read_fn(fp);
+    fclose(fp);
+    return result;
+}
+
+/*
+ * Read the input script and the frames to hash. Returns 0 on error.
+ */
+int script_init()
+{
+    g_num_events = 0;
+    g_next_event = 0;
+    g_num_hashes = 0;
+    g_mismatches = 0;
+    if (g_input_file && !read_file(g_input_file, read_input)) return 0;
+    if (g_batch_input_file && !read_file(g_batch_input_file, read_batch_input))
+    {
+        return 0;
+    }
+    if (g_golden_file && !read_file(g_golden_file, read_golden)) return 0;
+    if (g_hash_frames && !read_hash_frames(g_hash_frames))
+    {
+        printf("[ERROR] Invalid list of frames: %s\n", g_hash_frames);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Hash the visible part of a display, every plane of it.
+ */
+uint64_t hash_display(const display_t *display)
+{
+    uint64_t hash = 0xcbf29ce484222325; // FNV-1a
+    hash = (hash ^ display->width) * 0x100000001b3;
+    hash = (hash ^ display->height) * 0x100000001b3;
+    for (size_t plane = 0; plane < NUM_PLANES; plane++)
+    {
+        for (size_t row = 0; row < display->height; row++)
+        {
+            for (size_t word = 0; word < (display->width / 64); word++)
+            {
+                const uint64_t bits = display->rows[plane][row][word];
+                for (size_t i = 0; i < 64; i += 8)
+                {
+                    hash = (hash ^ ((bits >> i) & 0xff)) * 0x100000001b3;
+                }
+            }
+        }
+    }
+    return hash;
+}
+
+/*
+ * Called from the CPU thread in headless mode, after `frame` frames have run:
+ * hash the display if requested, and apply the input for the next frame.
+ */
+void script_frame(const size_t frame)
+{
+    if (frame == 0) g_next_event = 0; // a new run, e.g. with another engine
+
+    for (size_t i = 0; i < g_num_hashes; i++)
+    {
+        hash_t *hash = &g_hashes[i];
+        if (hash->frame != frame) continue;
+        const uint64_t value = hash_display(&g_display);
+        hash->done = 1;
+        printf("hash %zu %016llx\n", frame, (unsigned long long)value);
+        if (hash->has_expected && (value != hash->expected))
+        {
+            printf(
+                "[FAIL] Frame %zu: expected %016llx\n",
+                frame, (unsigned long long)hash->expected
+            );
+            g_mismatches++;
+        }
+    }
+
+    // In batch mode, each instance takes its own events (`next_input_event()`)
+    if (g_batch_size) return;
+
+    // A key release only ends an `Fx0A` wait during the frame it happens in
+    clear_key_events();
+    const input_event_t *event;
+    while ((event = next_input_event(frame)))
+    {
+        set_key(event->key, event->down);
+    }
+}
+
+/*
+ * Take the next scripted key change, if it happens by the start of the frame
+ * after `frame`. Returns NULL otherwise.
+ */
+const input_event_t *next_input_event(const size_t frame)
+{
+    if ((g_next_event == g_num_events) ||
+        (g_events[g_next_event].frame > (frame+1)))
+    {
+        return NULL;
+    }
+    return &g_events[g_next_event++];
+}
+
+/*
+ * Report the frames that were never reached. Returns the number of hashes
+ * that did not match their golden values, including those.
+ */
+size_t script_quit()
+{
+    for (size_t i = 0; i < g_num_hashes; i++)
+    {
+        if (g_hashes[i].done) continue;
+        printf("[FAIL] Frame %zu was never reached\n", g_hashes[i].frame);
+        if (g_hashes[i].has_expected) g_mismatches++;
+    }
+    if (g_golden_file)
+    {
+        printf("%s: %zu mismatches\n", g_golden_file, g_mismatches);
+    }
+    return g_mismatches;
+}
@@ -0,0 +1,29 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "io.h"
+
+/* A scripted change of one key */
+typedef struct
+{
+    size_t instance;    // whose key it is, in batch mode
+    size_t frame;       // at the start of which the key changes
+    uint8_t key;
+    uint8_t down;
+} input_event_t;
+
+extern char *g_input_file;
+extern char *g_batch_input_file;
+extern char *g_hash_frames;
+extern char *g_golden_file;
+
+extern int script_init();
+extern void script_frame(const size_t frame);
+extern const input_event_t *next_input_event(const size_t frame);
+extern uint64_t hash_display(const display_t *display);
+extern size_t script_quit();
+
+#endif // SCRIPT_H
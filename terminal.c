@@ -30,18 +30,18 @@ void write_registers_to_terminal(const chip8_t *c8, const uint16_t instruction)
 {
     mvprintw(
         g_terminal_rows[0], 0,
-        "Address %03x  Instruction %04x",
-        c8->program_counter, instruction
+        "Address %03x  Instruction %04x  IPF %-6zu",
+        c8->program_counter, instruction,
+        __atomic_load_n(&g_ipf, __ATOMIC_RELAXED)
     );
 
     mvprintw(g_terminal_rows[2], 0, "Timers");
-    pthread_mutex_lock(&g_timer_mutex);
     mvprintw(
         g_terminal_rows[3], 0,
         "Delay %02x  Sound %02x",
-        g_delay_timer, g_sound_timer
+        __atomic_load_n(&g_delay_timer, __ATOMIC_RELAXED),
+        __atomic_load_n(&g_sound_timer, __ATOMIC_RELAXED)
     );
-    pthread_mutex_unlock(&g_timer_mutex);
 
     mvprintw(
         g_terminal_rows[5], 0,
@@ -0,0 +1,23 @@
+# Record the sound of a headless run, and check the file against its golden
+# SHA-256 hash.
+#
+#   cmake -DCHIP8=PATH -DROM=PATH -DGOLDEN=PATH -P audio.cmake
+set(FRAMES 170)
+
+get_filename_component(NAME ${ROM} NAME_WE)
+set(WAV ${CMAKE_CURRENT_BINARY_DIR}/${NAME}.wav)
+execute_process(
+    COMMAND ${CHIP8} --headless --fps 0 --frames ${FRAMES}
+        --record-audio ${WAV} ${ROM}
+    OUTPUT_VARIABLE OUTPUT
+    RESULT_VARIABLE STATUS
+)
+if(NOT STATUS EQUAL 0)
+    message(FATAL_ERROR "The run failed:\n${OUTPUT}")
+endif()
+
+file(SHA256 ${WAV} HASH)
+file(STRINGS ${GOLDEN} EXPECTED LIMIT_COUNT 1)
+if(NOT HASH STREQUAL EXPECTED)
+    message(FATAL_ERROR "${NAME}.wav has SHA-256 ${HASH}, expected ${EXPECTED}")
+endif()
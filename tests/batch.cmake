@@ -0,0 +1,55 @@
+# Run a program in batch mode, and check each instance against a headless run
+# with its seed: both must stop on an error, or show the same display.
+#
+#   cmake -DCHIP8=PATH -DROM=PATH [-DINPUT=PATH] -P batch.cmake
+set(INSTANCES 4)
+set(FRAMES 600)
+math(EXPR LAST "${INSTANCES} - 1")
+
+set(BATCH_ARGS --batch ${INSTANCES} --fps 0 --frames ${FRAMES})
+set(HEADLESS_ARGS --headless --fps 0 --frames ${FRAMES} --hash-frames ${FRAMES})
+if(INPUT)
+    # Every instance presses the same keys
+    get_filename_component(NAME ${ROM} NAME_WE)
+    set(BATCH_INPUT ${CMAKE_CURRENT_BINARY_DIR}/${NAME}.batch.in)
+    file(STRINGS ${INPUT} LINES REGEX "^[0-9]")
+    file(WRITE ${BATCH_INPUT} "")
+    foreach(I RANGE ${LAST})
+        foreach(LINE ${LINES})
+            file(APPEND ${BATCH_INPUT} "${I} ${LINE}\n")
+        endforeach()
+    endforeach()
+    list(APPEND BATCH_ARGS --batch-input ${BATCH_INPUT})
+    list(APPEND HEADLESS_ARGS --input ${INPUT})
+endif()
+
+execute_process(
+    COMMAND ${CHIP8} ${BATCH_ARGS} ${ROM}
+    OUTPUT_VARIABLE BATCH_OUTPUT
+)
+
+foreach(I RANGE ${LAST})
+    execute_process(
+        COMMAND ${CHIP8} ${HEADLESS_ARGS} --seed ${I} ${ROM}
+        OUTPUT_VARIABLE OUTPUT
+        RESULT_VARIABLE STATUS
+    )
+    if(NOT BATCH_OUTPUT MATCHES
+        "Instance ${I}: PC [0-9a-f]+  Display ([0-9a-f]+)([^\n]*)")
+        message(FATAL_ERROR "Instance ${I} was not reported:\n${BATCH_OUTPUT}")
+    endif()
+    set(BATCH_HASH ${CMAKE_MATCH_1})
+    string(FIND "${CMAKE_MATCH_2}" "(halted)" HALTED)
+
+    if(NOT STATUS EQUAL 0)
+        if(HALTED EQUAL -1)
+            message(FATAL_ERROR
+                "Instance ${I} ran on, but a headless run stopped:\n${OUTPUT}")
+        endif()
+    elseif(NOT HALTED EQUAL -1)
+        message(FATAL_ERROR "Instance ${I} stopped:\n${BATCH_OUTPUT}")
+    elseif(NOT OUTPUT MATCHES "hash ${FRAMES} ${BATCH_HASH}")
+        message(FATAL_ERROR
+            "Instance ${I} shows ${BATCH_HASH}, a headless run:\n${OUTPUT}")
+    endif()
+endforeach()
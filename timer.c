@@ -1,90 +1,267 @@
 /*
  * This file contains the code for the timer thread, which performs the
- * following tasks at a frequency of 60Hz as precisely as it can:
+ * following tasks at a frequency of 60Hz as precisely as it can, and keeps
+ * statistics of how late each tick starts and how long rendering takes
+ * (`--timer-stats`):
  * - Render the display to the screen.
- * - Decrement the internal system timers.
- * - Play tone if sound timer is nonzero.
+ * - Decrement the internal system timers. (The audio callback plays the tone
+ *   while the sound timer is nonzero.)
+ * - Start the CPU thread's next frame.
  */
 #include <SDL2/SDL.h>
-#include <SDL2/SDL_audio.h>
+#include <errno.h>
 #include <pthread.h>
 #include <stdint.h>
-#ifdef DEBUG
 #include <stdio.h>
-#endif
 #include <time.h>
 
 #include "chip8.h"
 #include "draw.h"
 #include "io.h"
+#include "latency.h"
+#include "record.h"
 #include "timer.h"
 
-volatile uint8_t g_timer_start = 0;
+pthread_barrier_t g_start_barrier; // the timer and CPU threads meet at start
 uint8_t g_delay_timer = 0;
 uint8_t g_sound_timer = 0;
-pthread_mutex_t g_timer_mutex = {0};
+pthread_mutex_t g_tick_mutex = {0};
+pthread_cond_t g_tick_cond = {0};
+uint8_t g_timer_stats = 0;
+static size_t g_tick_count = 0;
 
+#define TIMER_BUCKETS 16
+#define MAX_CATCH_UP_TICKS 6    // beyond this, missed ticks are dropped
+static uint64_t g_lateness_histogram[TIMER_BUCKETS] = {0};
+static uint64_t g_render_histogram[TIMER_BUCKETS] = {0};
+static size_t g_caught_up_ticks = 0;
+static size_t g_resyncs = 0;
+
+/*
+ * Upload the rows of the display that changed, and present them. Nothing is
+ * presented if the display did not change, unless the window needs to be
+ * redrawn. The frame on screen is recorded every tick, if requested.
+ */
 static void update_display()
 {
-    pthread_mutex_lock(&g_display_mutex);
-    SDL_UpdateTexture(
-        g_texture,
-        NULL,
-        g_framebuffer,
-        g_width_in_bytes
-    );
-    pthread_cond_signal(&g_display_cond);
-    pthread_mutex_unlock(&g_display_mutex);
+    static const display_t *display = NULL; // the frame on screen
+    static size_t width = DISPLAY_WIDTH, height = DISPLAY_HEIGHT;
+    size_t first_row, last_row;
+    LATENCY(latency_take());
+    const display_t *next = take_display(&first_row, &last_row);
+    if (next)
+    {
+        display = next;
+        if ((display->width != width) || (display->height != height))
+        {
+            // The resolution changed, so the whole display is uploaded again
+            width = display->width;
+            height = display->height;
+            resize_texture(width, height);
+            first_row = 0;
+            last_row = (height-1);
+        }
+        else if (last_row >= height)
+        {
+            last_row = (height-1); // rows of a skipped frame, at another size
+        }
+        expand_display(display, g_framebuffer, first_row, last_row);
+        const SDL_Rect rows =
+        {
+            0, first_row, width, (last_row - first_row + 1)
+        };
+        SDL_UpdateTexture(
+            g_texture,
+            &rows,
+            &g_framebuffer[first_row*width],
+            g_width_in_bytes
+        );
+    }
+    if (display)
+    {
+        record_frame(display, g_framebuffer);
+    }
+    if (!next && !g_redraw)
+    {
+        return;
+    }
+    g_redraw = 0;
     SDL_RenderClear(g_renderer);
     SDL_RenderCopy(g_renderer, g_texture, NULL, NULL);
     SDL_RenderPresent(g_renderer);
+    if (next)
+    {
+        LATENCY(latency_present());
+    }
+}
+
+/*
+ * Decrement a system timer that is not zero yet, and return the value that it
+ * had. The CPU thread may set the timer at the same time, so the new value is
+ * only stored if the timer still holds the old one.
+ */
+static uint8_t decrement_timer(uint8_t *timer)
+{
+    uint8_t value = __atomic_load_n(timer, __ATOMIC_RELAXED);
+    while (value && !__atomic_compare_exchange_n(
+        timer, &value, (value-1), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+    ));
+    return value;
+}
+
+/*
+ * Decrement the system timers once. Returns nonzero if the tone should be
+ * playing during this tick.
+ */
+uint8_t decrement_timers()
+{
+    decrement_timer(&g_delay_timer);
+    return (decrement_timer(&g_sound_timer) > 0);
+}
+
+/*
+ * Start a new frame for the CPU thread.
+ */
+static void signal_tick()
+{
+    pthread_mutex_lock(&g_tick_mutex);
+    g_tick_count++;
+    pthread_cond_signal(&g_tick_cond);
+    pthread_mutex_unlock(&g_tick_mutex);
+}
+
+/*
+ * Called from the CPU thread. Block until the timer thread starts a frame that
+ * the CPU thread has not run yet. If the CPU thread has fallen behind by more
+ * than one frame, the frames that were missed are dropped.
+ */
+void wait_for_tick()
+{
+    static size_t last_tick = 0;
+    pthread_mutex_lock(&g_tick_mutex);
+    while ((g_tick_count == last_tick) && !g_io_done)
+    {
+        pthread_cond_wait(&g_tick_cond, &g_tick_mutex);
+    }
+    last_tick = g_tick_count;
+    pthread_mutex_unlock(&g_tick_mutex);
 }
 
-static void update_timers()
+static void add_ns(struct timespec *t, const long long ns)
+{
+    const long long total_ns = t->tv_nsec + ns;
+    t->tv_sec += (total_ns / 1000000000);
+    t->tv_nsec = (total_ns % 1000000000);
+}
+
+static long long elapsed_ns(
+    const struct timespec *before, const struct timespec *after
+)
+{
+    return (
+        (long long)(after->tv_sec - before->tv_sec) * 1000000000 +
+        (after->tv_nsec - before->tv_nsec)
+    );
+}
+
+/*
+ * Count a duration in a histogram bucket: bucket 0 holds durations under 1us,
+ * and each following bucket twice the durations of the one before it.
+ */
+static void add_to_histogram(uint64_t *histogram, const long long ns)
 {
-    pthread_mutex_lock(&g_timer_mutex);
-    if (g_delay_timer > 0)
+    size_t bucket = 0;
+    long long us = (ns > 0) ? (ns / 1000) : 0;
+    while (us && (bucket < (TIMER_BUCKETS-1)))
     {
-        g_delay_timer--;
+        us >>= 1;
+        bucket++;
     }
-    if (g_sound_timer > 0)
+    histogram[bucket]++;
+}
+
+static void print_histogram(const char *title, const uint64_t *histogram)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < TIMER_BUCKETS; i++)
     {
-        SDL_PauseAudioDevice(g_audio_device_id, 0); // play tone
-        g_sound_timer--;
+        total += histogram[i];
     }
-    else
+    printf("%s (%llu ticks):\n", title, (unsigned long long)total);
+    for (size_t i = 0; (i < TIMER_BUCKETS) && total; i++)
     {
-        SDL_PauseAudioDevice(g_audio_device_id, 1); // mute tone
+        if (!histogram[i]) continue;
+        if (i < (TIMER_BUCKETS-1))
+        {
+            printf("  < %6lu us", (1UL << i));
+        }
+        else
+        {
+            printf("  >=%6lu us", (1UL << (i-1)));
+        }
+        printf(
+            "  %10llu  %5.1f%%\n", (unsigned long long)histogram[i],
+            100.0 * histogram[i] / total
+        );
     }
-    pthread_mutex_unlock(&g_timer_mutex);
 }
 
+/*
+ * Print how late the ticks started and how long the display took to render.
+ */
+void timer_report()
+{
+    print_histogram("Tick lateness", g_lateness_histogram);
+    print_histogram("Render time", g_render_histogram);
+    printf(
+        "Ticks caught up: %zu  Resynchronized: %zu\n",
+        g_caught_up_ticks, g_resyncs
+    );
+}
+
+/*
+ * Each tick is started at an absolute deadline, one period after the last one,
+ * so that oversleeping does not accumulate as drift. A tick that starts more
+ * than a period late makes up for the ticks it missed by decrementing the
+ * system timers once for each of them, so that the program keeps its speed;
+ * the display is rendered only once. After a longer stall (e.g. a suspended
+ * process), the missed ticks are dropped and the deadlines start over.
+ */
 void *timer_fn(__attribute__ ((unused)) void *p)
 {
-    g_timer_start = 1;
-
-    const long period_ns = 16666667; // ~60Hz
-    struct timespec before, after, sleep;
-#ifdef CLOCK_MONOTONIC_RAW
-    const clockid_t clock_id = CLOCK_MONOTONIC_RAW;
-#else
-    const clockid_t clock_id = CLOCK_MONOTONIC;
-#endif
+    pthread_barrier_wait(&g_start_barrier);
+
+    const long long period_ns = 16666667; // ~60Hz
+    const clockid_t clock_id = CLOCK_MONOTONIC; // (_RAW cannot be slept on)
+    struct timespec deadline, now, rendered;
+    clock_gettime(clock_id, &deadline);
     while (!g_cpu_done)
     {
-        clock_gettime(clock_id, &before);
+        while (
+            clock_nanosleep(clock_id, TIMER_ABSTIME, &deadline, NULL) == EINTR
+        );
+        clock_gettime(clock_id, &now);
+        const long long late_ns = elapsed_ns(&deadline, &now);
+        add_to_histogram(g_lateness_histogram, late_ns);
+        long long missed = (late_ns / period_ns);
+        if (missed > MAX_CATCH_UP_TICKS)
+        {
+            g_resyncs++;
+            missed = 0;
+            deadline = now;
+        }
+        for (long long i = 0; i < missed; i++)
+        {
+            decrement_timers();
+            g_caught_up_ticks++;
+        }
+
         update_display();
-        update_timers();
-        clock_gettime(clock_id, &after);
-        const long remaining_ns =
-            period_ns + (before.tv_sec - after.tv_sec) * 1000000000 +
-            (before.tv_nsec - after.tv_nsec); // (period - elapsed)
-        sleep.tv_sec = (remaining_ns / 1000000000);
-        sleep.tv_nsec = (remaining_ns % 1000000000);
-#if 0
-        printf("Remaining: %ld ns\n", remaining_ns);
-#endif
-        nanosleep(&sleep, NULL);
+        clock_gettime(clock_id, &rendered);
+        add_to_histogram(g_render_histogram, elapsed_ns(&now, &rendered));
+        decrement_timers();
+        signal_tick();
+        add_ns(&deadline, (missed+1) * period_ns);
     }
 #ifdef DEBUG
     printf("%s exit\n", __func__);
@@ -4,10 +4,15 @@
 #include <pthread.h>
 #include <stdint.h>
 
-extern volatile uint8_t g_timer_start;
+extern pthread_barrier_t g_start_barrier;
 extern uint8_t g_delay_timer;
 extern uint8_t g_sound_timer;
-extern pthread_mutex_t g_timer_mutex;
+extern pthread_mutex_t g_tick_mutex;
+extern pthread_cond_t g_tick_cond;
+extern uint8_t g_timer_stats;
+extern void wait_for_tick();
+extern uint8_t decrement_timers();
+extern void timer_report();
 extern void *timer_fn(void *p);
 
 #endif // TIMER_H
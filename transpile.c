@@ -0,0 +1,425 @@
+/*
+ * This file contains the ahead-of-time transpiler, a build tool that is not
+ * part of the interpreter itself. It walks a CHIP-8 program from its start
+ * address, following every jump, call, and skip, and writes C code for every
+ * instruction that it can reach. The interpreter is then built with that code
+ * (see `AOT_ROM` in CMakeLists.txt) and runs it as the "aot" engine.
+ *
+ * Simple instructions are written out as plain C. All other instructions are
+ * handed back to the interpreter's own handlers through `aot_execute()`, so
+ * both engines share the same instruction semantics. Whenever the program
+ * counter leaves the translated code (e.g. a computed `Bnnn` jump to an
+ * address that was not reached), or the program writes into its own code, the
+ * interpreter takes over.
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8.h"
+#include "load.h"
+
+static const char *g_rom_path = NULL;
+static uint8_t g_memory[MEMORY_SIZE];
+static uint8_t g_reachable[MEMORY_SIZE];
+static uint8_t g_code[MEMORY_SIZE]; // bytes of reachable instructions
+static size_t g_rom_size = 0;
+
+static uint16_t fetch(const size_t address)
+{
+    return ((g_memory[address] << 8) | g_memory[address+1]);
+}
+
+static int is_translatable(const size_t address)
+{
+    return (address >= PROGRAM_START) && (address < (MEMORY_SIZE-1));
+}
+
+/*
+ * Instructions are two bytes long, except for the XO-CHIP's `F000 nnnn`.
+ */
+static uint16_t instruction_size(const size_t address)
+{
+#ifdef XO_CHIP
+    if (is_translatable(address) && (fetch(address) == 0xf000)) return 4;
+#endif
+    (void)address;
+    return 2;
+}
+
+/*
+ * Mark every instruction that control can reach from the start of the program.
+ */
+static void walk()
+{
+    static uint16_t worklist[MEMORY_SIZE];
+    size_t count = 0;
+    worklist[count++] = PROGRAM_START;
+    while (count)
+    {
+        const uint16_t address = worklist[--count];
+        if (!is_translatable(address) || g_reachable[address]) continue;
+        g_reachable[address] = 1;
+        const uint16_t size = instruction_size(address);
+        for (size_t i = 0; (i < size) && ((address+i) < MEMORY_SIZE); i++)
+        {
+            g_code[address+i] = 1;
+        }
+
+        const uint16_t instruction = fetch(address);
+        const uint16_t nnn = (instruction & 0x0fff);
+        const uint16_t skip = (address + 2 + instruction_size(address+2));
+        uint16_t next[2] = {address+size, 0};
+        switch (instruction >> 12)
+        {
+            case 0x0:
+#ifdef SUPER_CHIP
+                // Scroll and resolution instructions, e.g. 00Cn and 00FF
+                if (((instruction & 0xfff0) == 0x00c0) ||
+                    ((instruction >= 0x00fb) && (instruction <= 0x00ff) &&
+                    (instruction != 0x00fd)))
+                {
+                    break;
+                }
+#endif
+                if (instruction != 0x00e0) continue; // return, or no return
+                break;
+            case 0x1:
+                next[0] = nnn;
+                break;
+            case 0x2:
+                next[1] = nnn;
+                break;
+            case 0x3:
+            case 0x4:
+            case 0x5:
+            case 0x9:
+            case 0xe:
+                next[1] = skip;
+                break;
+            case 0xb:
+                continue; // computed jump
+        }
+        for (size_t i = 0; i < 2; i++)
+        {
+            if (next[i] && is_translatable(next[i]) && !g_reachable[next[i]])
+            {
+                worklist[count++] = next[i];
+            }
+        }
+    }
+}
+
+static void write_goto(FILE *fp, const uint16_t address)
+{
+    if (is_translatable(address) && g_reachable[address])
+    {
+        fprintf(fp, "    goto L_%03x;\n", address);
+    }
+    else
+    {
+        fprintf(fp, "    c8->program_counter = 0x%03x;\n", address);
+        fprintf(fp, "    goto dispatch;\n");
+    }
+}
+
+static void write_skip(FILE *fp, const uint16_t address, const char *condition)
+{
+    fprintf(fp, "    if (%s)\n    {\n    ", condition);
+    write_goto(fp, address + 2 + instruction_size(address+2));
+    fprintf(fp, "    }\n");
+    write_goto(fp, address+2);
+}
+
+/*
+ * Write plain C for the instruction, if it is simple enough. Returns 0 if the
+ * instruction must be executed by the interpreter instead.
+ */
+static int write_inline(
+    FILE *fp, const uint16_t address, const uint16_t instruction
+)
+{
+    const unsigned nnn = (instruction & 0x0fff);
+    const unsigned nn = (instruction & 0x00ff);
+    const unsigned x = ((instruction & 0x0f00) >> 8);
+    const unsigned y = ((instruction & 0x00f0) >> 4);
+    char condition[32];
+
+    switch (instruction >> 12)
+    {
+        case 0x1:
+            if (nnn < PROGRAM_START) return 0;
+            write_goto(fp, nnn);
+            return 1;
+        case 0x3:
+            sprintf(condition, "V[0x%x] == 0x%02x", x, nn);
+            write_skip(fp, address, condition);
+            return 1;
+        case 0x4:
+            sprintf(condition, "V[0x%x] != 0x%02x", x, nn);
+            write_skip(fp, address, condition);
+            return 1;
+        case 0x5:
+            if ((instruction & 0x000f) != 0x0) return 0;
+            sprintf(condition, "V[0x%x] == V[0x%x]", x, y);
+            write_skip(fp, address, condition);
+            return 1;
+        case 0x6:
+            fprintf(fp, "    V[0x%x] = 0x%02x;\n", x, nn);
+            break;
+        case 0x7:
+            fprintf(fp, "    V[0x%x] += 0x%02x;\n", x, nn);
+            break;
+        case 0x8:
+            switch (instruction & 0x000f)
+            {
+                case 0x0:
+                    fprintf(fp, "    V[0x%x] = V[0x%x];\n", x, y);
+                    break;
+                case 0x1:
+                case 0x2:
+                case 0x3:
+                    fprintf(
+                        fp, "    V[0x%x] %c= V[0x%x];\n    V[0xf] = 0x00;\n",
+                        x, "|&^"[(instruction & 0x000f)-1], y
+                    );
+                    break;
+                case 0x4:
+                    fprintf(
+                        fp,
+                        "    before = V[0x%x];\n"
+                        "    V[0x%x] += V[0x%x];\n"
+                        "    V[0xf] = (V[0x%x] < before) ? 1 : 0;\n",
+                        x, x, y, x
+                    );
+                    break;
+                case 0x5:
+                    fprintf(
+                        fp,
+                        "    before = V[0x%x];\n"
+                        "    V[0x%x] -= V[0x%x];\n"
+                        "    V[0xf] = (V[0x%x] > before) ? 0 : 1;\n",
+                        x, x, y, x
+                    );
+                    break;
+                case 0x6:
+#ifdef COSMAC_VIP
+                    fprintf(
+                        fp,
+                        "    flag = (V[0x%x] & 0x01);\n"
+                        "    V[0x%x] >>= 1;\n"
+                        "    V[0x%x] = V[0x%x];\n"
+                        "    V[0xf] = flag;\n",
+                        y, y, x, y
+                    );
+#else
+                    fprintf(
+                        fp,
+                        "    flag = (V[0x%x] & 0x01);\n"
+                        "    V[0x%x] >>= 1;\n"
+                        "    V[0xf] = flag;\n",
+                        x, x
+                    );
+#endif
+                    break;
+                case 0x7:
+                    fprintf(
+                        fp,
+                        "    V[0x%x] = (V[0x%x] - V[0x%x]);\n"
+                        "    V[0xf] = (V[0x%x] > V[0x%x]) ? 0 : 1;\n",
+                        x, y, x, x, y
+                    );
+                    break;
+                case 0xe:
+#ifdef COSMAC_VIP
+                    fprintf(
+                        fp,
+                        "    flag = ((V[0x%x] & 0x80) >> 7);\n"
+                        "    V[0x%x] <<= 1;\n"
+                        "    V[0x%x] = V[0x%x];\n"
+                        "    V[0xf] = flag;\n",
+                        y, y, x, y
+                    );
+#else
+                    fprintf(
+                        fp,
+                        "    flag = ((V[0x%x] & 0x80) >> 7);\n"
+                        "    V[0x%x] <<= 1;\n"
+                        "    V[0xf] = flag;\n",
+                        x, x
+                    );
+#endif
+                    break;
+                default:
+                    return 0;
+            }
+            break;
+        case 0x9:
+            if ((instruction & 0x000f) != 0x0) return 0;
+            sprintf(condition, "V[0x%x] != V[0x%x]", x, y);
+            write_skip(fp, address, condition);
+            return 1;
+        case 0xa:
+            fprintf(fp, "    c8->I = 0x%03x;\n", nnn);
+            break;
+        case 0xf:
+#ifdef XO_CHIP
+            if (instruction == 0xf000)
+            {
+                fprintf(fp, "    c8->I = 0x%04x;\n", fetch(address+2));
+                write_goto(fp, address+4);
+                return 1;
+            }
+#endif
+            if (nn != 0x1e) return 0;
+            fprintf(fp, "    c8->I += V[0x%x];\n", x);
+            break;
+        default:
+            return 0;
+    }
+    write_goto(fp, address+2);
+    return 1;
+}
+
+static void write_program(FILE *fp)
+{
+    fprintf(
+        fp,
+        "/*\n"
+        " * Generated by chip8-transpile from %s. Do not edit.\n"
+        " */\n"
+        "#include <stddef.h>\n"
+        "#include <stdint.h>\n"
+        "\n"
+        "#include \"aot.h\"\n"
+        "#include \"chip8.h\"\n"
+        "#include \"profile.h\"\n"
+        "\n"
+        "#pragma GCC diagnostic ignored \"-Wunused-label\"\n"
+        "\n",
+        g_rom_path
+    );
+
+    fprintf(fp, "const size_t AOT_ROM_SIZE = %zu;\n", g_rom_size);
+    fprintf(fp, "const uint8_t AOT_ROM[] =\n{");
+    for (size_t i = 0; i < g_rom_size; i++)
+    {
+        fprintf(
+            fp, "%s0x%02x,", ((i % 12) == 0) ? "\n    " : " ",
+            g_memory[PROGRAM_START+i]
+        );
+    }
+    fprintf(fp, "\n};\n\n");
+
+    // Bytes that belong to translated instructions
+    fprintf(fp, "const uint8_t AOT_CODE_MAP[MEMORY_SIZE] =\n{");
+    for (size_t i = 0; i < MEMORY_SIZE; i++)
+    {
+        fprintf(fp, "%s%d,", ((i % 32) == 0) ? "\n    " : " ", g_code[i]);
+    }
+    fprintf(fp, "\n};\n\n");
+
+    fprintf(
+        fp,
+        "size_t aot_run(chip8_t *c8, const size_t budget)\n"
+        "{\n"
+        "    uint8_t *const V = c8->V;\n"
+        "    uint8_t before, flag;\n"
+        "    size_t count = 0;\n"
+        "    (void)V;\n"
+        "    (void)before;\n"
+        "    (void)flag;\n"
+        "\n"
+        "dispatch:\n"
+        "    if (c8->end_of_frame || !g_aot_valid) return count;\n"
+        "    switch (c8->program_counter)\n"
+        "    {\n"
+    );
+    for (size_t i = 0; i < MEMORY_SIZE; i++)
+    {
+        if (g_reachable[i])
+        {
+            fprintf(fp, "        case 0x%03zx: goto L_%03zx;\n", i, i);
+        }
+    }
+    fprintf(
+        fp,
+        "        default: return count;\n"
+        "    }\n"
+    );
+
+    for (size_t i = 0; i < MEMORY_SIZE; i++)
+    {
+        if (!g_reachable[i]) continue;
+        const uint16_t instruction = fetch(i);
+        fprintf(
+            fp,
+            "\n"
+            "L_%03zx: // %04x\n"
+            "    if (count == budget)\n"
+            "    {\n"
+            "        c8->program_counter = 0x%03zx;\n"
+            "        return count;\n"
+            "    }\n"
+            "    count++;\n"
+            "    PROFILE_INSTRUCTION(0x%03zx, 0x%04x);\n",
+            i, instruction, i, i, instruction
+        );
+        if (!write_inline(fp, i, instruction))
+        {
+            fprintf(
+                fp,
+                "    c8->program_counter = 0x%03zx;\n"
+                "    aot_execute(c8);\n"
+                "    goto dispatch;\n",
+                i+2
+            );
+        }
+    }
+    fprintf(fp, "}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        printf("[USAGE] %s ROM OUTPUT\n", argv[0]);
+        return 1;
+    }
+    g_rom_path = argv[1];
+
+    FILE *rom = fopen(g_rom_path, "rb");
+    if (!rom)
+    {
+        printf("[ERROR] Unable to open file\n");
+        return 1;
+    }
+    g_rom_size = fread(
+        &g_memory[PROGRAM_START], 1, (MEMORY_SIZE-PROGRAM_START), rom
+    );
+    const int too_big = (fgetc(rom) != EOF);
+    fclose(rom);
+    if ((g_rom_size < 2) || too_big)
+    {
+        printf("[ERROR] Size is out of range\n");
+        return 1;
+    }
+
+    walk();
+
+    FILE *fp = fopen(argv[2], "w");
+    if (!fp)
+    {
+        printf("[ERROR] Unable to open %s for writing\n", argv[2]);
+        return 1;
+    }
+    write_program(fp);
+    fclose(fp);
+
+    size_t count = 0;
+    for (size_t i = 0; i < MEMORY_SIZE; i++)
+    {
+        count += g_reachable[i];
+    }
+    printf("Translated %zu instructions into %s\n", count, argv[2]);
+    return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * The functions in this file capture the sound of a headless run to a WAV file
+ * (`--record-audio FILE`), without opening an audio device. At the end of each
+ * frame, the CPU thread renders that frame's share of the tone (1/60 of a
+ * second of samples) while the sound timer still holds the value it had during
+ * the frame, so the sound keeps in step with the program however fast it runs.
+ *
+ * Samples are 16-bit mono PCM at 44100Hz. They are gathered in a buffer that is
+ * allocated once and written out whenever it fills up. The sizes in the header
+ * are filled in at the end, if the file is seekable; a named pipe is left with
+ * the largest sizes, which readers take to mean "until the end of the stream".
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fileio.h"
+#include "io.h"
+#include "wav.h"
+
+#define SAMPLES_PER_FRAME (AUDIO_SAMPLE_RATE / 60)
+#define BUFFER_FRAMES 60 // one second of sound is written at a time
+
+char *g_wav_file = NULL;
+
+static int g_wav_fd = -1;           // -1 if not capturing
+static int16_t *g_samples = NULL;   // waiting to be written
+static size_t g_num_samples = 0;
+static uint64_t g_samples_written = 0;
+static float g_frame[2*SAMPLES_PER_FRAME]; // stereo, as rendered
+
+/*
+ * Fill in a 44-byte WAV header for `data_size` bytes of samples, or for a
+ * stream of unknown length if that is 0xffffffff.
+ */
+static void make_header(uint8_t *header, const uint32_t data_size)
+{
+    memcpy(&header[0], "RIFF", 4);
+    put_u32(
+        &header[4], (data_size == 0xffffffff) ? data_size : (data_size + 36)
+    );
+    memcpy(&header[8], "WAVEfmt ", 8);
+    put_u32(&header[16], 16);                       // size of this chunk
+    put_u16(&header[20], 1);                        // PCM
+    put_u16(&header[22], 1);                        // channels
+    put_u32(&header[24], AUDIO_SAMPLE_RATE);
+    put_u32(&header[28], AUDIO_SAMPLE_RATE * 2);    // bytes per second
+    put_u16(&header[32], 2);                        // bytes per sample
+    put_u16(&header[34], 16);                       // bits per sample
+    memcpy(&header[36], "data", 4);
+    put_u32(&header[40], data_size);
+}
+
+/*
+ * Open the WAV file, if one was requested. Returns 0 on error.
+ */
+int wav_init()
+{
+    if (!g_wav_file) return 1;
+
+    g_wav_fd = open(g_wav_file, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (g_wav_fd < 0)
+    {
+        printf("[ERROR] Unable to open %s for writing\n", g_wav_file);
+        return 0;
+    }
+    signal(SIGPIPE, SIG_IGN); // a reader that goes away only ends the capture
+
+    g_samples = (int16_t*)malloc(
+        BUFFER_FRAMES * SAMPLES_PER_FRAME * sizeof(int16_t)
+    );
+    g_num_samples = 0;
+    g_samples_written = 0;
+
+    uint8_t header[44];
+    make_header(header, 0xffffffff);
+    if (!g_samples || !write_all(g_wav_fd, header, sizeof(header)))
+    {
+        printf("[ERROR] Unable to start capturing to %s\n", g_wav_file);
+        wav_quit();
+        return 0;
+    }
+    return 1;
+}
+
+static int flush_samples()
+{
+    const int written =
+        write_all(g_wav_fd, g_samples, g_num_samples * sizeof(int16_t));
+    g_samples_written += g_num_samples;
+    g_num_samples = 0;
+    return written;
+}
+
+/*
+ * Called from the CPU thread at the end of each headless frame, before the
+ * system timers are decremented.
+ */
+void wav_frame()
+{
+    if (g_wav_fd < 0) return;
+
+    render_audio(g_frame, SAMPLES_PER_FRAME);
+    for (size_t i = 0; i < SAMPLES_PER_FRAME; i++)
+    {
+        const float sample = g_frame[2*i] * 32767; // left channel
+        g_samples[g_num_samples++] = (int16_t)(
+            (sample > 32767) ? 32767 : ((sample < -32767) ? -32767 : sample)
+        );
+    }
+    if ((g_num_samples == (BUFFER_FRAMES * SAMPLES_PER_FRAME)) &&
+        !flush_samples())
+    {
+        printf("[WARNING] Audio capture stopped (%s)\n", strerror(errno));
+        close(g_wav_fd);
+        g_wav_fd = -1;
+    }
+}
+
+void wav_quit()
+{
+    if (g_wav_fd >= 0)
+    {
+        flush_samples();
+        const uint64_t data_size = (g_samples_written * sizeof(int16_t));
+        if (
+            (data_size < (0xffffffff - 36)) &&
+            (lseek(g_wav_fd, 0, SEEK_CUR) >= 0) // not a named pipe
+        )
+        {
+            uint8_t header[44];
+            make_header(header, (uint32_t)data_size);
+            const ssize_t written =
+                pwrite(g_wav_fd, header, sizeof(header), 0);
+            if (written != (ssize_t)sizeof(header))
+            {
+                printf("[WARNING] Unable to finish %s\n", g_wav_file);
+            }
+        }
+        close(g_wav_fd);
+        g_wav_fd = -1;
+    }
+    if (g_samples)
+    {
+        free(g_samples);
+        g_samples = NULL;
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef WAV_H
+#define WAV_H
+
+extern char *g_wav_file;
+
+extern int wav_init();
+extern void wav_frame();
+extern void wav_quit();
+
+#endif // WAV_H